@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "kernels.hpp"
+#include "dijkstra.hpp"
+#include "parameters.hpp"
+
+#define SYSTEM_COUNT 8192
+#define WARP_COUNT 64
+#define ITERATIONS 4000
+
+static float xs[SYSTEM_COUNT], ys[SYSTEM_COUNT], zs[SYSTEM_COUNT];
+static float cxs[SYSTEM_COUNT], cys[SYSTEM_COUNT], czs[SYSTEM_COUNT];
+static float distance_sq[SYSTEM_COUNT], times[SYSTEM_COUNT];
+static int candidates[SYSTEM_COUNT];
+
+static double seconds_since(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1E9;
+}
+
+/*
+ * Compares the warp times of every kernel set the host supports with the
+ * scalar Dijkstra::get_time, for the warp speed of every preset, over
+ * distances from a few hundred kilometres to the edge of a large system.
+ * Returns the number of kernel sets which are off by more than the
+ * tolerance of get_time_batch.
+ */
+static int check_warp_times() {
+    float times[WARP_COUNT], expected, worst;
+    int failures = 0;
+
+    for (int i = 0; i < SYSTEM_COUNT; i++) {
+        double distance = 2E5 * pow(1000 * AU_TO_M / 2E5, i / (double) (SYSTEM_COUNT - 1));
+
+        cxs[i] = distance * 0.36;
+        cys[i] = distance * 0.48;
+        czs[i] = distance * 0.8;
+    }
+
+    for (int k = 0; k < kernel_set_count; k++) {
+        const struct kernel_set *ks = &kernel_sets[k];
+
+        if (!kernel_set_is_supported(ks)) continue;
+
+        worst = 0;
+
+        for (int p = 0; p < preset_count; p++) {
+            float speed = presets[p].parameters->warp_speed;
+
+            for (int o = 0; o < SYSTEM_COUNT; o += WARP_COUNT) {
+                ks->get_time_batch(speed, 0, 0, 0, cxs + o, cys + o, czs + o, times, WARP_COUNT);
+
+                for (int i = 0; i < WARP_COUNT; i++) {
+                    float d = sqrt(cxs[o + i] * cxs[o + i] + cys[o + i] * cys[o + i] + czs[o + i] * czs[o + i]);
+                    expected = Dijkstra::get_time(speed, d);
+                    worst = fmax(worst, fabs(times[i] - expected) - TIME_BATCH_RELATIVE * fabs(expected));
+                }
+            }
+        }
+
+        if (worst > TIME_BATCH_TOLERANCE) {
+            fprintf(stderr, "%8s: warp times are off by %.2e s more than the tolerance allows\n", ks->name, worst - TIME_BATCH_TOLERANCE);
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+/*
+ * Measures the throughput of every kernel set the host supports, on a random
+ * New Eden sized cloud of systems for the jump scan, and on system sized
+ * batches of celestials for the warp time. Fails without measuring anything
+ * if the warp times of a kernel set are off, and with --check only checks.
+ */
+int main(int argc, char **argv) {
+    struct timespec start;
+    volatile int sink = 0;
+    double jump, warp;
+    float range_sq = pow(7.0 * LY_TO_M, 2.0);
+
+    if (check_warp_times()) return 1;
+    if (argc > 1 && strcmp(argv[1], "--check") == 0) return 0;
+
+    srand(1);
+
+    for (int i = 0; i < SYSTEM_COUNT; i++) {
+        xs[i] = (rand() / (double) RAND_MAX - 0.5) * 200 * LY_TO_M;
+        ys[i] = (rand() / (double) RAND_MAX - 0.5) * 20 * LY_TO_M;
+        zs[i] = (rand() / (double) RAND_MAX - 0.5) * 200 * LY_TO_M;
+
+        cxs[i] = (rand() / (double) RAND_MAX - 0.5) * 100 * AU_TO_M;
+        cys[i] = (rand() / (double) RAND_MAX - 0.5) * 10 * AU_TO_M;
+        czs[i] = (rand() / (double) RAND_MAX - 0.5) * 100 * AU_TO_M;
+    }
+
+    fprintf(stderr, "%8s %6s %24s %24s\n", "kernels", "width", "jump scan (Msystems/s)", "warp time (Mpairs/s)");
+
+    for (int k = 0; k < kernel_set_count; k++) {
+        const struct kernel_set *ks = &kernel_sets[k];
+
+        if (!kernel_set_is_supported(ks)) {
+            fprintf(stderr, "%8s %6d %24s %24s\n", ks->name, ks->width, "unsupported", "unsupported");
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (int i = 0; i < ITERATIONS; i++) {
+            sink += ks->get_jump_candidates(xs, ys, zs, SYSTEM_COUNT, xs[i % SYSTEM_COUNT], ys[i % SYSTEM_COUNT], zs[i % SYSTEM_COUNT], range_sq, candidates, distance_sq);
+        }
+
+        jump = (double) ITERATIONS * SYSTEM_COUNT / seconds_since(&start) / 1E6;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (int i = 0; i < ITERATIONS * (SYSTEM_COUNT / WARP_COUNT); i++) {
+            int o = (i * WARP_COUNT) % SYSTEM_COUNT;
+            ks->get_time_batch(3.0, cxs[i % SYSTEM_COUNT], cys[i % SYSTEM_COUNT], czs[i % SYSTEM_COUNT], cxs + o, cys + o, czs + o, times, WARP_COUNT);
+            sink += times[0] > 0;
+        }
+
+        warp = (double) ITERATIONS * SYSTEM_COUNT / seconds_since(&start) / 1E6;
+
+        fprintf(stderr, "%8s %6d %24.1f %24.1f%s\n", ks->name, ks->width, jump, warp, ks == get_kernel_set() ? " (active)" : "");
+    }
+
+    return 0;
+}
@@ -0,0 +1,514 @@
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <argp.h>
+#include <sys/resource.h>
+
+#include "universe.hpp"
+#include "parameters.hpp"
+#include "kernels.hpp"
+#include "synthetic.hpp"
+#include "distance_tree.hpp"
+
+struct arguments {
+    char *args[2];
+    int queries;
+    uint64_t seed;
+    bool generic, compare;
+    SyntheticUniverse *synthetic;
+};
+
+static char args_doc[] = "[mapDenormalized mapJumps]";
+
+static struct argp_option options[] = {
+    {"queries", 'n', "count", 0, "Number of queries per workload and preset", 0},
+    {"seed", 'S', "value", 0, "Seed for the workload generators", 0},
+    {"synthetic", 'Y', "systems[:entities[:degree]]", 0, "Use a synthetic universe instead of the SDE", 0},
+    {"generic", 'g', 0, 0, "Use the generic solver instead of the specialised ones", 0},
+    {"compare", 'C', 0, 0, "Compare every engine with the reference solver, and fail on any difference", 0},
+    { 0 }
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    struct arguments *arguments = (struct arguments *) state->input;
+
+    switch (key) {
+        case 'n':
+            arguments->queries = atoi(arg);
+            break;
+        case 'S':
+            arguments->seed = strtoull(arg, NULL, 10);
+            break;
+        case 'g':
+            arguments->generic = true;
+            break;
+        case 'C':
+            arguments->compare = true;
+            break;
+        case 'Y':
+            arguments->synthetic = new SyntheticUniverse();
+            sscanf(arg, "%d:%d:%f", &arguments->synthetic->systems, &arguments->synthetic->entities, &arguments->synthetic->degree);
+            break;
+        case ARGP_KEY_ARG:
+            if (state->arg_num >= 2)
+            argp_usage(state);
+            arguments->args[state->arg_num] = arg;
+            break;
+        case ARGP_KEY_END:
+            if (state->arg_num < 2 && !arguments->synthetic)
+            argp_usage(state);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, NULL };
+
+/*
+ * A small xorshift generator, so that the workloads are the same on every
+ * platform and C library for a given seed.
+ */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+static double seconds_since(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1E9;
+}
+
+class Workloads {
+public:
+    Workloads(Universe &u) {
+        for (int i = 0; i < u.system_count; i++) {
+            System *s = &u.systems[i];
+
+            if (s->entity_count == 0) continue;
+
+            if (s->id < 31000000) {
+                known_space.push_back(s);
+                regions[s->region_id].push_back(s);
+
+                if (s->security < 0.5) low_security.push_back(s);
+            } else if (s->id < 32000000) {
+                wormhole_space.push_back(s);
+            }
+        }
+    }
+
+    /*
+     * Picks an origin and destination for the given workload. Local queries
+     * stay within one system, regional ones within one region of known space
+     * and wormhole ones go from known space into wormhole space. Capital
+     * queries connect two low or null security systems anywhere in known
+     * space, which is where jump drives can be used.
+     */
+    bool pick(char type, uint64_t *rng, Celestial **src, Celestial **dst) {
+        System *src_s, *dst_s;
+
+        if (known_space.empty()) return false;
+
+        if (type == 'c') {
+            if (low_security.empty()) return false;
+
+            src_s = low_security[next_random(rng) % low_security.size()];
+            dst_s = low_security[next_random(rng) % low_security.size()];
+        } else {
+            src_s = known_space[next_random(rng) % known_space.size()];
+
+            if (type == 'l') {
+                dst_s = src_s;
+            } else if (type == 'r') {
+                std::vector<System *> &region = regions[src_s->region_id];
+                dst_s = region[next_random(rng) % region.size()];
+            } else if (type == 'w') {
+                if (wormhole_space.empty()) return false;
+                dst_s = wormhole_space[next_random(rng) % wormhole_space.size()];
+            } else {
+                return false;
+            }
+        }
+
+        *src = &src_s->entities[next_random(rng) % src_s->entity_count];
+        *dst = &dst_s->entities[next_random(rng) % dst_s->entity_count];
+
+        return true;
+    }
+
+private:
+    std::vector<System *> known_space, wormhole_space, low_security;
+    std::map<int, std::vector<System *>> regions;
+};
+
+static const struct {
+    const char *name;
+    char type;
+} workloads[] = {
+    { "local", 'l' },
+    { "regional", 'r' },
+    { "wormhole", 'w' },
+    { "capital", 'c' },
+};
+
+static double percentile(std::vector<double> &sorted, double p) {
+    if (sorted.empty()) return 0.0;
+
+    return sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+/*
+ * The engines compared with the reference solver, which is the generic one
+ * scanning for jumps, as it was before any of the others existed.
+ */
+static Route *route_reference(Universe &u, Celestial &src, Celestial &dst, Parameters &p) {
+    Parameters q = p;
+
+    q.specialise = false;
+    q.use_jump_graph = false;
+
+    return u.get_route(src, dst, &q);
+}
+
+static Route *route_specialised(Universe &u, Celestial &src, Celestial &dst, Parameters &p) {
+    Parameters q = p;
+
+    q.use_jump_graph = false;
+
+    return u.get_route(src, dst, &q);
+}
+
+static Route *route_default(Universe &u, Celestial &src, Celestial &dst, Parameters &p) {
+    return u.get_route(src, dst, &p);
+}
+
+static Route *route_hierarchical(Universe &u, Celestial &src, Celestial &dst, Parameters &p) {
+    return u.get_hierarchical_route(src, dst, &p);
+}
+
+static Route *route_alternative(Universe &u, Celestial &src, Celestial &dst, Parameters &p) {
+    std::vector<Route *> routes = u.get_alternative_routes(src, dst, 1, &p);
+
+    return routes.empty() ? NULL : routes[0];
+}
+
+static Route *route_distance_tree(Universe &u, Celestial &src, Celestial &dst, Parameters &p) {
+    return DistanceTree(u, src, &p).get_route(dst);
+}
+
+static const struct {
+    const char *name;
+    Route *(*route)(Universe &, Celestial &, Celestial &, Parameters &);
+} engines[] = {
+    { "reference", route_reference },
+    { "specialised", route_specialised },
+    { "jump_graph", route_default },
+    { "hierarchical", route_hierarchical },
+    { "alternative", route_alternative },
+    { "distance_tree", route_distance_tree },
+    { "batch", NULL },
+};
+
+static const int engine_count = sizeof(engines) / sizeof(engines[0]);
+
+static bool same_cost(double a, double b) {
+    return (isnan(a) && isnan(b)) || fabs(a - b) <= 0.01 + 1E-5 * fabs(b);
+}
+
+/*
+ * Checks that a route goes from the origin to the destination over
+ * connections which exist, that the time never goes backwards, and that the
+ * cost is the time of the last waypoint. Returns what is wrong, or NULL.
+ */
+static const char *check_route(Route *route, Celestial *src, Celestial *dst, Parameters &p) {
+    if (route->points.empty()) return "no waypoints";
+    if (route->points.front().entity != src || route->points.front().type != STRT) return "does not start at the origin";
+    if (route->points.back().entity != dst) return "does not end at the destination";
+
+    for (unsigned int i = 1; i < route->points.size(); i++) {
+        struct waypoint &a = route->points[i - 1], &b = route->points[i];
+        System *from = a.entity->system, *to = b.entity->system;
+        float range = isnan(p.jump_range) ? a.entity->jump_range : p.jump_range;
+        double dx = from->x - to->x, dy = from->y - to->y, dz = from->z - to->z;
+
+        if (b.time < a.time) return "time goes backwards";
+
+        if (b.type == GATE) {
+            if (a.entity->destination != b.entity) return "gate without a stargate";
+        } else if (b.type == WARP) {
+            if (from != to) return "warp to another system";
+        } else if (b.type == JUMP) {
+            if (a.entity->bridge != b.entity && (isnan(range) || to->security >= 0.5 ||
+                sqrt(dx * dx + dy * dy + dz * dz) / LY_TO_M > range * 1.0001)) return "jump out of range";
+        } else {
+            return "starts again halfway";
+        }
+    }
+
+    if (!same_cost(route->points.back().time, route->cost)) return "cost is not the time of the last waypoint";
+
+    return NULL;
+}
+
+struct engine_result {
+    std::vector<double> latency;
+    long mismatches, invalid;
+};
+
+static int report(int e, const char *workload, const char *preset, int model, Celestial *src, Celestial *dst, const char *problem, double cost, double expected) {
+    static int reported = 0;
+
+    if (reported++ < 20) {
+        fprintf(stderr, "%s: %s, %s, fatigue model %d, from %d to %d: %s (%.3f, reference %.3f)\n",
+            engines[e].name, workload, preset, model, src->id, dst->id, problem, cost, expected
+        );
+    }
+
+    return 1;
+}
+
+/*
+ * Routes every workload with every preset, and every fatigue model for ships
+ * with a jump drive, with every engine. Costs must match the reference and
+ * every route must be valid. Writes the number of differences and the
+ * latency of every engine to standard output as JSON, and returns the
+ * number of differences.
+ */
+static long run_compare(Universe &universe, Workloads &generator, struct arguments &arguments) {
+    std::vector<struct engine_result> results(engine_count);
+    struct timespec start;
+    long failures = 0;
+
+    for (auto const& w : workloads) {
+        std::vector<std::pair<Celestial *, Celestial *>> pairs;
+        uint64_t rng = arguments.seed * 0x9E3779B97F4A7C15ull + w.type;
+        Celestial *src, *dst;
+
+        for (int i = 0; i < arguments.queries && generator.pick(w.type, &rng, &src, &dst); i++) {
+            pairs.push_back(std::make_pair(src, dst));
+        }
+
+        for (int p = 0; p < preset_count; p++) {
+            int models = isnan(presets[p].parameters->jump_range) ? 1 : FATIGUE_FULL + 1;
+
+            for (int m = 0; m < models; m++) {
+                Parameters parameters = *presets[p].parameters;
+                std::vector<double> expected;
+                std::vector<int> src_ids, dst_ids;
+
+                if (models > 1) parameters.fatigue_model = (enum fatigue_model) m;
+
+                for (auto const& q : pairs) {
+                    for (int e = 0; e < engine_count; e++) {
+                        if (engines[e].route == NULL) continue;
+
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+                        Route *route = engines[e].route(universe, *q.first, *q.second, parameters);
+                        results[e].latency.push_back(seconds_since(&start));
+
+                        double cost = route ? route->cost : NAN;
+                        const char *problem = route ? check_route(route, q.first, q.second, parameters) : NULL;
+
+                        if (e == 0) expected.push_back(cost);
+
+                        if (problem) {
+                            results[e].invalid++;
+                            failures += report(e, w.name, presets[p].name, parameters.fatigue_model, q.first, q.second, problem, cost, expected.back());
+                        } else if (!same_cost(cost, expected.back())) {
+                            results[e].mismatches++;
+                            failures += report(e, w.name, presets[p].name, parameters.fatigue_model, q.first, q.second, "different cost", cost, expected.back());
+                        }
+
+                        delete route;
+                    }
+
+                    /*
+                     * Batches take ids, which only name the entities that
+                     * are found by id.
+                     */
+                    if (universe.get_entity_or_default(q.first->id) == q.first && universe.get_entity_or_default(q.second->id) == q.second) {
+                        src_ids.push_back(q.first->id);
+                        dst_ids.push_back(q.second->id);
+                    } else {
+                        expected.pop_back();
+                    }
+                }
+
+                if (src_ids.empty()) continue;
+
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                RouteBatch *batch = universe.get_route_batch(src_ids, dst_ids, &parameters);
+                double elapsed = seconds_since(&start);
+
+                for (unsigned int i = 0; i < src_ids.size(); i++) {
+                    struct engine_result &r = results[engine_count - 1];
+
+                    r.latency.push_back(elapsed / src_ids.size());
+
+                    if (!same_cost(batch->costs[i], expected[i])) {
+                        r.mismatches++;
+                        failures += report(engine_count - 1, w.name, presets[p].name, parameters.fatigue_model,
+                            universe.get_entity_or_default(src_ids[i]), universe.get_entity_or_default(dst_ids[i]), "different cost", batch->costs[i], expected[i]);
+                    }
+                }
+
+                delete batch;
+            }
+        }
+    }
+
+    printf("{\n");
+    printf("  \"systems\": %d,\n", universe.system_count);
+    printf("  \"entities\": %d,\n", universe.entity_count);
+    printf("  \"seed\": %llu,\n", (unsigned long long) arguments.seed);
+    printf("  \"engines\": [");
+
+    for (int e = 0; e < engine_count; e++) {
+        std::vector<double> &latency = results[e].latency;
+        double total = 0.0;
+
+        for (auto const& l : latency) {
+            total += l;
+        }
+
+        std::sort(latency.begin(), latency.end());
+
+        printf("%s\n    {\"engine\": \"%s\", \"queries\": %lu, \"mismatches\": %ld, \"invalid\": %ld, "
+               "\"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p99_ms\": %.4f}",
+            e ? "," : "", engines[e].name, latency.size(), results[e].mismatches, results[e].invalid,
+            latency.empty() ? 0.0 : total / latency.size() * 1E3,
+            percentile(latency, 0.50) * 1E3, percentile(latency, 0.99) * 1E3
+        );
+    }
+
+    printf("\n  ],\n");
+    printf("  \"failures\": %ld\n", failures);
+    printf("}\n");
+
+    return failures;
+}
+
+/*
+ * Runs every workload against every ship preset and writes the results to
+ * standard output as a single JSON document. The workloads only depend on
+ * the seed and the universe, so runs of different builds are comparable.
+ * With a synthetic universe, the load time is the time taken to generate it.
+ */
+int main(int argc, char **argv) {
+    struct arguments arguments;
+    struct timespec start;
+    struct rusage usage;
+    double load_time;
+    bool first = true;
+
+    arguments.queries = 100;
+    arguments.seed = 1;
+    arguments.generic = false;
+    arguments.compare = false;
+    arguments.synthetic = NULL;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (arguments.synthetic) {
+        arguments.synthetic->seed = arguments.seed;
+    }
+
+    Universe *loaded = arguments.synthetic ? arguments.synthetic->generate() : new Universe(arguments.args[0], arguments.args[1]);
+    Universe &universe = *loaded;
+
+    load_time = seconds_since(&start);
+
+    Workloads generator(universe);
+
+    if (arguments.compare) {
+        long failures = run_compare(universe, generator, arguments);
+
+        delete loaded;
+        delete arguments.synthetic;
+
+        return failures ? 1 : 0;
+    }
+
+    printf("{\n");
+    printf("  \"systems\": %d,\n", universe.system_count);
+    printf("  \"entities\": %d,\n", universe.entity_count);
+    printf("  \"kernels\": \"%s\",\n", get_kernel_set()->name);
+    printf("  \"solver\": \"%s\",\n", arguments.generic ? "generic" : "specialised");
+    printf("  \"seed\": %llu,\n", (unsigned long long) arguments.seed);
+    printf("  \"load_seconds\": %.6f,\n", load_time);
+    printf("  \"results\": [");
+
+    for (auto const& w : workloads) {
+        std::vector<std::pair<Celestial *, Celestial *>> pairs;
+        uint64_t rng = arguments.seed * 0x9E3779B97F4A7C15ull + w.type;
+        Celestial *src, *dst;
+
+        for (int i = 0; i < arguments.queries && generator.pick(w.type, &rng, &src, &dst); i++) {
+            pairs.push_back(std::make_pair(src, dst));
+        }
+
+        for (int p = 0; p < preset_count; p++) {
+            Parameters parameters = *presets[p].parameters;
+            std::vector<double> latency;
+            long loops = 0, edges = 0;
+            int found = 0;
+            double total = 0.0;
+
+            parameters.specialise = !arguments.generic;
+
+            for (auto const& q : pairs) {
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                Route *route = universe.get_route(*q.first, *q.second, &parameters);
+                latency.push_back(seconds_since(&start));
+
+                if (route) {
+                    loops += route->loops;
+                    edges += route->edges;
+                    found++;
+                }
+
+                delete route;
+            }
+
+            for (auto const& l : latency) {
+                total += l;
+            }
+
+            std::sort(latency.begin(), latency.end());
+
+            printf("%s\n    {\"workload\": \"%s\", \"preset\": \"%s\", \"queries\": %lu, \"routes\": %d, "
+                   "\"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p99_ms\": %.4f, \"loops\": %ld, \"edges\": %ld}",
+                first ? "" : ",", w.name, presets[p].name, pairs.size(), found,
+                latency.empty() ? 0.0 : total / latency.size() * 1E3,
+                percentile(latency, 0.50) * 1E3, percentile(latency, 0.99) * 1E3, loops, edges
+            );
+
+            first = false;
+        }
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("\n  ],\n");
+    printf("  \"peak_rss_kb\": %ld\n", usage.ru_maxrss);
+    printf("}\n");
+
+    delete loaded;
+    delete arguments.synthetic;
+
+    return 0;
+}
@@ -1,10 +1,12 @@
-%module eve_nerd
+%module(threads="1") eve_nerd
 
 %feature("autodoc", "1");
 
 %{
 #include "universe.hpp"
 #include "parameters.hpp"
+#include "synthetic.hpp"
+#include "distance_tree.hpp"
 
 namespace swig {
     template <typename T> swig_type_info *type_info();
@@ -23,12 +25,163 @@ namespace swig {
 %template(DistanceMap) std::map<Celestial *, float>;
 %template(CelestialVector) std::vector<Celestial *>;
 %template(IntVector) std::vector<int>;
+%template(FloatVector) std::vector<float>;
+%template(RouteVector) std::vector<Route *>;
+
+/*
+ * Only the calls which spend their time searching or loading release the
+ * GIL, everything else is too short for it to pay off.
+ */
+%nothread;
+%thread Universe::Universe;
+%thread Universe::get_route;
+%thread Universe::get_route_batch;
+%thread Universe::get_hierarchical_route;
+%thread Universe::get_alternative_routes;
+%thread Universe::get_all_distances;
+%thread Universe::get_reachable;
+%thread Universe::get_system_distances;
+%thread Universe::export_shared;
+%thread Universe::attach_shared;
+%thread SyntheticUniverse::generate;
+%thread DistanceTree::DistanceTree;
+%thread DistanceTree::update;
+%thread DistanceTree::get_all_distances;
+
+%newobject SyntheticUniverse::generate;
+%newobject Universe::get_route_batch;
+%newobject Route::as_batch;
+%newobject Universe::attach_shared;
+%newobject Universe::get_system_distances;
+
+/*
+ * The alternative routes are handed over to the caller, one by one.
+ */
+%pythonappend Universe::get_alternative_routes %{
+    for r in val:
+        r.thisown = True
+%}
+
+/*
+ * The tables of an attached universe are mapped read-only, so systems and
+ * entities can not be changed from Python at all. Their offset pointers are
+ * declared as plain pointers to SWIG, and names are read through accessors.
+ * This holds for every universe, as setting a field directly would also
+ * bypass the change journal and leave caches stale, see the README.
+ */
+%immutable Entity::x;
+%immutable Entity::y;
+%immutable Entity::z;
+%immutable Entity::id;
+%immutable Entity::seq_id;
+%immutable Entity::name;
+%immutable Celestial::type;
+%immutable Celestial::group_id;
+%immutable Celestial::system;
+%immutable Celestial::destination;
+%immutable Celestial::bridge;
+%immutable Celestial::jump_range;
+%immutable System::entity_count;
+%immutable System::region_id;
+%immutable System::entities;
+%immutable System::gates;
+%immutable System::security;
+%immutable System::removed;
+
+%extend Entity {
+    const char *name;
+}
+
+%{
+const char *Entity_name_get(Entity *e) {
+    return e->name;
+}
+%}
 
 %include "universe.hpp"
 %include "parameters.hpp"
+%include "synthetic.hpp"
+%include "distance_tree.hpp"
+
+%pythoncode {
+import ctypes
+import threading
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+if numpy is not None:
+    ROUTE_RECORD_DTYPE = numpy.dtype([
+        ("entity", "<i4"), ("system", "<i4"), ("type", "<i4"), ("time", "<f4"),
+        ("fatigue", "<f4"), ("reactivation", "<f4"), ("wait", "<f4"), ("distance", "<f4"),
+    ])
+
+def _view_memory(owner, address, count, size, dtype, format):
+    """
+    Views count items of the given size at an address owned by a C++ object
+    without copying them. The buffer holds a reference to the owner, so the
+    memory stays valid for as long as the view is alive. Without numpy, this
+    returns a memoryview of the given struct format instead.
+    """
+    if count == 0:
+        buffer = (ctypes.c_char * 0)()
+    else:
+        buffer = (ctypes.c_char * (count * size)).from_address(address)
+        buffer._owner = owner
+
+    if numpy is None:
+        return memoryview(buffer).cast("B").cast(format)
+
+    return numpy.frombuffer(buffer, dtype=dtype, count=count)
+
+_executor = None
+_executor_lock = threading.Lock()
+
+def _get_executor():
+    global _executor
+
+    with _executor_lock:
+        if _executor is None:
+            from concurrent.futures import ThreadPoolExecutor
+            _executor = ThreadPoolExecutor(thread_name_prefix="eve_nerd")
+
+    return _executor
+}
+
+%extend RouteBatch {
+%pythoncode {
+    @property
+    def records(self):
+        return _view_memory(self, self.get_records_address(), self.offsets[-1], 32, ROUTE_RECORD_DTYPE if numpy else None, "B")
+
+    @property
+    def offsets(self):
+        return _view_memory(self, self.get_offsets_address(), self.size() + 1, 4, "<i4", "i")
+
+    @property
+    def costs(self):
+        return _view_memory(self, self.get_costs_address(), self.size(), 8, "<f8", "d")
+
+    def route(self, i):
+        o = self.offsets
+        return self.records[o[i]:o[i + 1]]
+
+    def __len__(self):
+        return self.size()
+
+    def __repr__(self):
+        return "<RouteBatch of %d routes>" % self.size()
+}
+}
 
 %extend Route {
 %pythoncode {
+    @property
+    def records(self):
+        return self.as_batch().records
+
     @property
     def start(self):
         return self.points[0].entity
@@ -49,8 +202,28 @@ namespace swig {
             yield self.get_system_by_seq_id(i)
 
     def get_entities(self):
-        for i in range(self.entity_count):
-            yield self.get_entity_by_seq_id(i)
+        for i in range(self.get_entity_slots()):
+            e = self.get_entity_by_seq_id(i)
+
+            if e.system is not None:
+                yield e
+
+    def route_async(self, src, dst, parameters, executor=None):
+        """
+        Starts searching for a route on a worker thread and returns a
+        concurrent.futures.Future of it. Searches do not hold the GIL, so
+        several of them run in parallel.
+        """
+        return (executor or _get_executor()).submit(self.get_route, [src, dst], parameters)
+
+    def route_asyncio(self, src, dst, parameters, executor=None, loop=None):
+        """
+        The same as route_async, but returns an asyncio future which can be
+        awaited in the given or the current event loop.
+        """
+        import asyncio
+
+        return asyncio.wrap_future(self.route_async(src, dst, parameters, executor), loop=loop)
 }
 }
 
@@ -78,6 +251,13 @@ namespace swig {
 }
 }
 
+%extend search_stats {
+%pythoncode {
+    def __repr__(self):
+        return "<Search stats: %d settled, %d warps, %d gates, %d jumps>" % (self.settled, self.relaxed_warp, self.relaxed_gate, self.relaxed_jump)
+}
+}
+
 %extend waypoint {
 %pythoncode {
     def __repr__(self):
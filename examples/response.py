@@ -18,20 +18,18 @@ cases = [
 fig = plt.figure(figsize=(10, 10), dpi=300)
 
 for i, (n, shiptype) in enumerate(cases):
-    b = a.get_all_distances(30003135, shiptype)
+    # Travel times in seconds to every system within 30 minutes, by sequence id
+    b = a.get_reachable(30003135, 30 * 60, shiptype)
 
     sys = []
     res = {}
 
-    for e, _d in b.items():
-        c = (e.system.id, e.system.x / LY_TO_M, e.system.z / LY_TO_M)
-        d = _d / 60
-        if d < res.get(c, float("inf")):
-            res[c] = d
-
-            if c not in sys:
-                sys.append(c)
-
+    for j, d in enumerate(b):
+        if d != float("inf"):
+            s = a.get_system_by_seq_id(j)
+            c = (s.id, s.x / LY_TO_M, s.z / LY_TO_M)
+            res[c] = d / 60
+            sys.append(c)
 
     ax = fig.add_subplot(3, 2, i + 1)
     ax.set_aspect('equal', 'datalim')
@@ -44,3 +44,23 @@ print_route(b)
 c = eve_nerd.Parameters(8.0, 1.5, 10.0)
 b = a.get_route([30003135, 30004704, 30003181], c)
 print_route(b)
+
+# Route many pairs at once; the result can be read as numpy arrays without
+# going through the waypoint objects
+d = a.get_route_batch([30003135, 30003135], [30004696, 30004955], eve_nerd.CARRIER)
+
+for i in range(len(d)):
+    print("%.0f seconds through systems %s" % (d.costs[i], d.route(i)["system"]))
+
+# The closest entity of every system within an hour of D-P, by system sequence
+# id, without a map of every entity in the universe
+e = a.get_system_distances(30003135, eve_nerd.CARRIER, 3600)
+
+for i, t in enumerate(e.times):
+    if e.entities[i] is not None:
+        print("%s in %.0f seconds, at %s" % (a.get_system_by_seq_id(i).name, t, e.entities[i].name))
+
+# Up to five routes through different systems, shortest first, for when the
+# shortest one is camped
+for r in a.get_alternative_routes(30003135, 30004704, 5, eve_nerd.BATTLECRUISER):
+    print_route(r)
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "universe.hpp"
+
+struct batch_stats {
+    long count, found, failed;
+};
+
+/*
+ * Routes every request line of a file, in the format of the server protocol,
+ * with the given number of worker threads, and writes a line of JSON for each
+ * to the output. The output is either in the order of the input or in the
+ * order in which routes are found. Only a bounded number of lines are read
+ * ahead of the output, so inputs of any length stream through in constant
+ * memory.
+ */
+void run_batch(Universe &, FILE *, FILE *, const Parameters &, bool, int, bool, struct batch_stats *);
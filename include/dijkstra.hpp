@@ -3,38 +3,106 @@
 #include "universe.hpp"
 #include "min_heap.hpp"
 
+/*
+ * The arrays a search works in, sized for a particular universe. Allocating
+ * and initialising these dominates the cost of short queries, so universes
+ * keep a pool of workspaces which searches borrow and return. The system
+ * coordinates only change along with the universe generation, so they are
+ * only copied again when that changes.
+ */
+class Workspace {
+public:
+    Workspace(Universe &);
+    ~Workspace();
+
+    bool fits(Universe &);
+
+    int systems, entities, max_entities, generation;
+
+    float *sys_x, *sys_y, *sys_z, *sys_penalty;
+    bool *sys_blocked;
+    float *cost, *penalty, *fatigue, *reactivation, *wait, *distance;
+    float *warp_x, *warp_y, *warp_z, *warp_time;
+    Celestial **warp_targets;
+    enum movement_type *type;
+    int *prev, *vist;
+
+    MinHeap<float, int> *queue;
+};
+
+/*
+ * The movement a solver is compiled for: gates, bridges and beacons but no
+ * jump drive, a jump drive but no gates, or both. The fatigue model is the
+ * other template argument, or ANY_FATIGUE where it is read at run time.
+ */
+enum solver_movement {
+    SOLVE_ANY, SOLVE_GATES, SOLVE_JUMPS, SOLVE_MIXED
+};
+
+#define ANY_FATIGUE -1
+
 class Dijkstra {
 public:
     Dijkstra(Universe &, Celestial *, Celestial *, Parameters *);
+    Dijkstra(Universe &, Celestial *, Parameters *, Workspace *);
     ~Dijkstra();
 
+    void initialise();
+    void solve();
+
     Route *get_route();
     Route *get_route(Celestial *);
+    Route *get_path(Celestial *);
+    bool append_route(RouteBatch *);
     std::map<Celestial *, float> *get_all_distances();
+    void get_system_distances(float, std::vector<float> *, std::vector<Celestial *> *);
+    std::vector<Route *> get_alternative_routes(int);
+
+    void repair(std::vector<struct graph_change> &);
+    void reach(Celestial *);
+
+    static float get_time(float, float);
 
 private:
-    void solve_w_set(Celestial *);
-    void solve_g_set(Celestial *);
-    void solve_j_set(Celestial *);
-    void solve_r_set(Celestial *);
-    void solve_internal();
+    void attach(Workspace *);
+    int get_path_length(Celestial *);
+    void solve_reverse(std::vector<float> *, float);
+    float get_jump_bound(float);
 
-    float get_time(float);
+    template <int M, int F> void solve_w_set(Celestial *);
+    template <int M, int F> void solve_g_set(Celestial *);
+    template <int M, int F> void solve_j_set(Celestial *);
+    template <int F> void solve_j_range(Celestial *, int, int, float);
+    template <int M, int F> void solve_r_set(Celestial *);
+    template <int M> void solve_fatigue();
+    template <int M, int F> void solve_as();
+    void solve_internal();
 
     bool celestial_is_relevant(Celestial &);
+    void compile_constraints();
 
-    void update_administration(Celestial *, Celestial *, float, enum movement_type);
+    template <int F> void update_administration(Celestial *, Celestial *, float, enum movement_type);
 
     Universe& universe;
     Celestial *src, *dst;
     Parameters *parameters;
 
-    float *sys_c, *sys_x, *sys_y, *sys_z;
-    float *cost, *fatigue, *reactivation, *wait, *distance;
+    Workspace *workspace;
+    bool pooled, repairing = false;
+    float budget = INFINITY;
+    float *heuristic = NULL;
+    JumpGraph *jump_graph = NULL;
+
+    float *sys_x, *sys_y, *sys_z, *sys_penalty;
+    bool *sys_blocked;
+    float *cost, *penalty, *fatigue, *reactivation, *wait, *distance;
+    float *warp_x, *warp_y, *warp_z, *warp_time;
+    Celestial **warp_targets;
     enum movement_type *type;
     int *prev, *vist;
 
-    int loops = 0;
+    int loops = 0, edges = 0;
+    struct search_stats stats = {};
 
     MinHeap<float, int> *queue;
 };
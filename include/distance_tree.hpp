@@ -0,0 +1,43 @@
+#pragma once
+
+#include <map>
+
+#include "universe.hpp"
+
+/*
+ * The travel times from one entity to every other, kept up to date as the
+ * connections of the universe change. Rather than searching all over again,
+ * the tree replays the journal of the universe and repairs only the part of
+ * the search the changes affect. It searches again when the journal does not
+ * go back far enough, or when the cost of a jump depends on the path taken,
+ * which is the case for ships with a jump drive and for the fatigue
+ * countdown models.
+ */
+class DistanceTree {
+public:
+    DistanceTree(Universe &, Celestial &, Parameters *);
+    DistanceTree(Universe &, int, Parameters *);
+    ~DistanceTree();
+
+    bool update();
+
+    float get_distance(Celestial &);
+    float get_distance(int);
+
+    Route *get_route(Celestial &);
+    Route *get_route(int);
+
+    std::map<Celestial *, float> *get_all_distances();
+
+    int generation;
+
+private:
+    void solve();
+    bool is_repairable();
+
+    Universe &universe;
+    Celestial *src;
+    int src_id;
+    Parameters parameters;
+    Workspace *workspace = NULL;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "universe.hpp"
+#include "precompute_store.hpp"
+
+/*
+ * Every system within a fixed jump range of every other system, found once
+ * instead of by a geometric scan whenever the search expands an entity. The
+ * neighbours of the system with sequence id i are targets[offsets[i]] up to
+ * targets[offsets[i + 1]], in the order the scan would find them, along with
+ * their distances in light years. High security systems can not be jumped
+ * into and are left out. Jumps land on the entities of a system from its
+ * gates onward, which the universe keeps current, so the graph only depends
+ * on where the systems are. With a store, the arrays are mapped from it if
+ * they were built before, and written to it otherwise.
+ */
+class JumpGraph {
+public:
+    JumpGraph(Universe &, float, PrecomputeStore *store=NULL);
+
+    float range;
+    int generation;
+
+    const int *offsets, *targets;
+    const float *distances;
+
+private:
+    void build(Universe &);
+    bool load(Universe &, PrecomputeStore *);
+    void save(Universe &, PrecomputeStore *);
+
+    std::vector<int> built_offsets, built_targets;
+    std::vector<float> built_distances;
+};
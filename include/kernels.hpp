@@ -0,0 +1,53 @@
+#pragma once
+
+#define AU_TO_M 149597870700.0
+#define LY_TO_M 9460730472580800.0
+
+/*
+ * The jump range scan processes the systems in fixed-size chunks, so that the
+ * candidate buffers can live on the stack.
+ */
+#define JUMP_CHUNK 256
+
+/*
+ * The SIMD kernels of the solver, compiled once for every supported
+ * instruction set. The best set the host CPU supports is selected when the
+ * library is loaded, so a generic build still uses AVX2 or AVX-512 where it
+ * can. The scalar set is a portable fallback for non-x86 machines.
+ */
+struct kernel_set {
+    const char *name;
+    int width;
+
+    int (*get_jump_candidates)(const float *, const float *, const float *, int, float, float, float, float, int *, float *);
+    void (*get_time_batch)(float, float, float, float, const float *, const float *, const float *, float *, int);
+};
+
+extern const struct kernel_set kernel_sets[];
+extern const int kernel_set_count;
+
+bool kernel_set_is_supported(const struct kernel_set *);
+const struct kernel_set *get_kernel_set();
+
+/*
+ * Scans n points, given as separate x, y and z arrays, for those within
+ * range of a single point. Writes the indices of the points in range and
+ * their squared distances to the output arrays, and returns their count.
+ */
+int get_jump_candidates(const float *, const float *, const float *, int, float, float, float, float, int *, float *);
+
+/*
+ * Computes the warp time from a single point to n other points, given as
+ * separate x, y and z arrays, for a ship with the given warp speed. This is
+ * the batched equivalent of Dijkstra::get_time, and uses a polynomial
+ * approximation of the natural logarithm instead of calling log twice per
+ * pair. The approximation has a relative error below 3e-7. The results are
+ * within TIME_BATCH_TOLERANCE seconds plus TIME_BATCH_RELATIVE times the
+ * warp time of the scalar implementation, which is about 3e-5 seconds for
+ * warps within a system. eve_nerd_kernel_bench checks every kernel set
+ * against this.
+ */
+#define TIME_BATCH_TOLERANCE 4E-5
+#define TIME_BATCH_RELATIVE 4E-7
+
+void get_time_batch(float, float, float, float, const float *, const float *, const float *, float *, int);
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <time.h>
+
+#include "parameters.hpp"
+
+class Universe;
+
+#define METRICS_SHARDS 16
+#define METRICS_SERIES 16
+#define METRICS_BUCKETS 14
+
+enum metrics_cache {
+    CACHE_REGION_ROUTER,
+    CACHE_WORKSPACE,
+    CACHE_JUMP_GRAPH,
+    CACHE_COUNT
+};
+
+/*
+ * The counters of a single preset. Every query is counted, and queries for
+ * which no route exists are also counted as failures. The latency is kept
+ * as a histogram with fixed bucket bounds, plus a sum in nanoseconds.
+ */
+struct metrics_series {
+    std::atomic<unsigned long> queries, failures, latency_ns;
+    std::atomic<unsigned long> buckets[METRICS_BUCKETS];
+};
+
+/*
+ * The padding keeps the counters of neighbouring shards on separate cache
+ * lines, whatever the alignment of the allocation.
+ */
+struct metrics_shard {
+    struct metrics_series series[METRICS_SERIES];
+    std::atomic<unsigned long> cache_hits[CACHE_COUNT], cache_misses[CACHE_COUNT];
+    char padding[64];
+};
+
+/*
+ * Aggregate counters of a universe for monitoring long-running services.
+ * Every thread records into its own shard with relaxed atomics, so recording
+ * never contends on a lock or a shared cache line; the shards are only
+ * summed when the metrics are dumped. Queries are attributed to the preset
+ * whose ship parameters they match, or to "custom" if there is none.
+ */
+class Metrics {
+public:
+    Metrics();
+    ~Metrics();
+
+    void start(struct timespec *);
+    void record_query(Parameters *, struct timespec *, bool);
+    void record_cache(enum metrics_cache, bool);
+
+    std::string to_prometheus(Universe &);
+    std::string to_json(Universe &);
+
+private:
+    struct metrics_shard *get_shard();
+    static int get_series(Parameters *);
+
+    struct metrics_shard *shards;
+};
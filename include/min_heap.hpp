@@ -16,6 +16,8 @@ public:
     bool decrease(P, V);
     void decrease_raw(P, V);
     bool is_empty();
+    bool contains(V);
+    void clear();
 
 private:
     void swap(V, V);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * A pointer stored as the distance from its own address to its target, so
+ * that structures which only point within a single block of memory stay
+ * valid wherever that block is mapped. A copy points at the same target as
+ * the original, not at the same distance. Nothing points at itself, so a
+ * distance of zero stands for NULL.
+ */
+template <class T> class offset_ptr {
+public:
+    offset_ptr(): offset(0) {}
+    offset_ptr(T *p) { set(p); }
+    offset_ptr(const offset_ptr &p) { set(p.get()); }
+
+    offset_ptr &operator=(T *p) {
+        set(p);
+        return *this;
+    }
+
+    offset_ptr &operator=(const offset_ptr &p) {
+        set(p.get());
+        return *this;
+    }
+
+    T *get() const {
+        return offset ? (T *) ((char *) this + offset) : NULL;
+    }
+
+    operator T *() const { return get(); }
+    T *operator->() const { return get(); }
+    T &operator*() const { return *get(); }
+
+private:
+    void set(T *p) {
+        offset = p ? (char *) p - (char *) this : 0;
+    }
+
+    ptrdiff_t offset;
+};
@@ -1,5 +1,22 @@
 #pragma once
 
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+#ifndef SWIG
+/*
+ * The 64-bit FNV-1a hash, which can be continued from an earlier hash.
+ */
+static inline uint64_t fnv1a(const void *data, unsigned long size, uint64_t h=14695981039346656037ull) {
+    for (unsigned long i = 0; i < size; i++) {
+        h = (h ^ ((const unsigned char *) data)[i]) * 1099511628211ull;
+    }
+
+    return h;
+}
+#endif
+
 enum fatigue_model {
     /*
      * Horrible inaccurate fatigue model that does not assign a fatigue-related
@@ -31,16 +48,70 @@ class Parameters {
     #endif
 
 public:
-    Parameters(float warp_speed=3.0, float align_time=5.0, float gate_cost=14.0, float jump_range=NAN, float jump_range_reduction=0.0) {
+    Parameters(float warp_speed=3.0, float align_time=5.0, float gate_cost=14.0, float jump_range=NAN, float jump_range_reduction=0.0, float min_security=NAN, float max_security=NAN, float security_penalty=0.0) {
         this->warp_speed = warp_speed;
         this->align_time = align_time;
         this->gate_cost = gate_cost;
         this->jump_range = jump_range;
         this->jump_range_reduction = jump_range_reduction;
+        this->min_security = min_security;
+        this->max_security = max_security;
+        this->security_penalty = security_penalty;
+    }
+
+    void avoid_system(int id) {
+        avoided_systems.push_back(id);
+    }
+
+    void avoid_region(int id) {
+        avoided_regions.push_back(id);
     }
 
+    #ifndef SWIG
+    /*
+     * A hash of everything which changes the routes found, but not of the
+     * switches which only choose how they are found.
+     */
+    uint64_t hash() const {
+        float values[] = { warp_speed, align_time, gate_cost, jump_range, jump_range_reduction, min_security, max_security, security_penalty };
+        uint64_t h = fnv1a(values, sizeof(values));
+
+        h = fnv1a(&fatigue_model, sizeof(fatigue_model), h);
+        h = fnv1a(avoided_systems.data(), avoided_systems.size() * sizeof(int), h);
+        h = fnv1a("|", 1, h);
+
+        return fnv1a(avoided_regions.data(), avoided_regions.size() * sizeof(int), h);
+    }
+    #endif
+
     float jump_range = NAN, warp_speed, align_time, gate_cost, jump_range_reduction;
     enum fatigue_model fatigue_model = FATIGUE_FATIGUE_COUNTDOWN;
+
+    /*
+     * Searches run a solver compiled for the movement and fatigue model of
+     * the ship. Turning this off runs the generic solver instead, which finds
+     * the same routes, for comparison.
+     */
+    bool specialise = true;
+
+    /*
+     * Jumps with the ship's own drive follow a graph of the systems in range
+     * of every system, built once per jump range and shared by all searches,
+     * instead of scanning for them. Turning this off scans, for comparison.
+     */
+    bool use_jump_graph = true;
+
+    /*
+     * Routing constraints. Systems with a security status outside of the
+     * (optional) minimum and maximum, or which appear in one of the avoidance
+     * lists, are never entered unless they contain the origin or destination.
+     * A non-zero security penalty adds that many seconds times one minus the
+     * security status (at most one) to the search cost of entering a system,
+     * which makes the router prefer safer space without changing the
+     * reported travel time.
+     */
+    float min_security, max_security, security_penalty;
+    std::vector<int> avoided_systems, avoided_regions;
 };
 
 static const Parameters FRIGATE = Parameters(5.0, 3.0);
@@ -59,3 +130,31 @@ static const Parameters TITAN = Parameters(1.37, 60.0, NAN, 6.0);
 
 static const Parameters RORQUAL = Parameters(1.5, 50.0, NAN, 10.0, 0.9);
 static const Parameters JUMP_FREIGHTER = Parameters(1.5, 40.0, 14.0, 10.0, 0.9);
+
+#ifndef SWIG
+/*
+ * All of the ship presets above by name, so that tools can iterate over them.
+ */
+struct preset {
+    const char *name;
+    const Parameters *parameters;
+};
+
+static const struct preset presets[] = {
+    { "FRIGATE", &FRIGATE },
+    { "DESTROYER", &DESTROYER },
+    { "INDUSTRIAL", &INDUSTRIAL },
+    { "CRUISER", &CRUISER },
+    { "BATTLECRUISER", &BATTLECRUISER },
+    { "BATTLESHIP", &BATTLESHIP },
+    { "BLACK_OPS", &BLACK_OPS },
+    { "CARRIER", &CARRIER },
+    { "DREADNOUGHT", &DREADNOUGHT },
+    { "SUPERCARRIER", &SUPERCARRIER },
+    { "TITAN", &TITAN },
+    { "RORQUAL", &RORQUAL },
+    { "JUMP_FREIGHTER", &JUMP_FREIGHTER },
+};
+
+static const int preset_count = sizeof(presets) / sizeof(presets[0]);
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <stdint.h>
+
+/*
+ * A directory of precomputed data which only depends on the map and on a
+ * few ship parameters, such as jump graphs and region tables. Every entry is
+ * a file named after its kind, the checksum of the universe it was computed
+ * for and a key, usually Parameters::hash. Entries are mapped read-only when
+ * they are first asked for, and stay mapped for as long as the store lives.
+ * A file is only used if its header matches the checksum, key and size, and
+ * its contents match the hash in the header, so stale or broken files are
+ * computed again and replaced.
+ */
+class PrecomputeStore {
+public:
+    PrecomputeStore(std::string, uint64_t);
+    ~PrecomputeStore();
+
+    const void *load(const char *, uint64_t, unsigned long *);
+    void save(const char *, uint64_t, const void *, unsigned long);
+
+    uint64_t checksum;
+
+private:
+    std::string get_path(const char *, uint64_t);
+
+    std::string directory;
+    std::vector<std::pair<void *, unsigned long>> mappings;
+    std::mutex lock;
+};
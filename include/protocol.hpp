@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+
+#include "universe.hpp"
+
+/*
+ * A single routing request of the server and batch protocols. Requests are
+ * lines of text, either two entity or system ids separated by whitespace,
+ * or a flat JSON object such as
+ *
+ *     {"id": 7, "src": 30000142, "dst": 30002187, "preset": "CARRIER", "jump": 6.0}
+ *
+ * The id may be any number or string and is echoed back verbatim. The ship
+ * parameters start out as the given preset, or the defaults of the program
+ * otherwise, and the fields warp, align, gate, jump, jump_reduction,
+ * min_security, max_security and safety override them. The avoid and
+ * avoid_regions fields take arrays of ids, and hierarchical routes over the
+ * region hierarchy. A request with "op": "metrics" returns the metrics of
+ * the universe instead of a route.
+ */
+struct request {
+    enum { ROUTE, METRICS } op;
+    std::string id, error;
+    int src, dst;
+    bool hierarchical;
+    Parameters parameters;
+};
+
+enum request_result {
+    REQUEST_FOUND, REQUEST_NOT_FOUND, REQUEST_FAILED
+};
+
+bool parse_request(const char *, const Parameters &, bool, struct request *);
+
+std::string format_route(const struct request &, Route *);
+std::string format_error(const struct request &);
+
+std::string handle_request(Universe &, const char *, const Parameters &, bool, enum request_result *result=NULL);
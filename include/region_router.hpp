@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include "universe.hpp"
+#include "precompute_store.hpp"
+
+/*
+ * A region of the overlay graph. The nodes are all routing-relevant entities
+ * in the region, ordered by system. The boundary nodes are those stargates
+ * which lead into a different region, and the table holds the shortest
+ * in-region travel time between every pair of boundary nodes.
+ */
+class Region {
+public:
+    int id;
+    std::vector<Celestial *> nodes;
+    std::vector<int> boundary;
+    std::vector<float> table;
+};
+
+class RegionRouter {
+public:
+    RegionRouter(Universe &, Parameters *, PrecomputeStore *store=NULL);
+    ~RegionRouter();
+
+    static bool is_applicable(Parameters *);
+
+    Route *get_route(Celestial *, Celestial *);
+
+    int generation;
+    bool has_bridges = false;
+
+private:
+    int search(Region &, Celestial *, std::vector<float> &, std::vector<int> &, int *);
+    float get_cost_to(Region &, std::vector<float> &, Celestial *, Celestial *, int *);
+    void unpack(Region &, std::vector<int> &, int, std::vector<Celestial *> &);
+
+    float get_warp_time(Celestial *, Celestial *);
+
+    Universe &universe;
+    Parameters parameters;
+
+    std::vector<Region> regions;
+    std::vector<Celestial *> boundary;
+    std::vector<int> boundary_region, boundary_slot;
+
+    int *region_of, *local, *global, *sys_begin, *sys_end;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "universe.hpp"
+
+/*
+ * A client of the server. Requests are numbered in the order they arrive,
+ * and responses are held back until all earlier ones have been sent, so that
+ * clients can pipeline requests and still read the responses in order.
+ */
+struct server_connection {
+    int fd, events;
+    bool eof;
+    long received, sent;
+    std::string input, output;
+    std::map<long, std::string> responses;
+};
+
+struct server_job {
+    int connection;
+    long sequence;
+    std::string line;
+};
+
+/*
+ * A routing server which answers the lines of the request protocol over a
+ * Unix domain or TCP socket, with a line of JSON each. A single thread runs
+ * the event loop, which accepts clients and reads and writes them without
+ * blocking, and a pool of worker threads routes the requests. The server
+ * runs until it receives SIGINT or SIGTERM.
+ */
+class Server {
+public:
+    Server(Universe &, const Parameters &, bool, int);
+    ~Server();
+
+    bool listen(const char *);
+    void run();
+
+private:
+    void accept_connection();
+    void read_connection(int);
+    void flush_connection(int);
+    void close_connection(int);
+    void update_events(int);
+    void work();
+
+    Universe &universe;
+    Parameters parameters;
+    bool hierarchical;
+    int worker_count;
+
+    int listen_fd = -1, epoll_fd = -1, wake_fd = -1, signal_fd = -1, next_connection = 0;
+    std::string unix_path;
+
+    /*
+     * The workers only look up connections and store responses, under the
+     * lock. Everything else about connections belongs to the event loop.
+     */
+    std::map<int, struct server_connection *> connections;
+    std::deque<struct server_job> jobs;
+    std::vector<int> finished;
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable available;
+    bool stopping = false;
+};
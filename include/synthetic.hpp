@@ -0,0 +1,36 @@
+#pragma once
+
+#include "universe.hpp"
+
+/*
+ * Builds artificial universes of arbitrary size, so that the solvers can be
+ * tested and benchmarked without the SDE and beyond the size of New Eden.
+ * The same seed always produces the same universe.
+ *
+ * Systems are spread uniformly over a flattened box whose size follows from
+ * the density, given in systems per cubic lightyear. They are grouped into
+ * regions of neighbouring systems along a Morton curve, and connected by a
+ * chain of stargates along the same curve plus links to nearby systems until
+ * the requested average gate degree is reached.
+ */
+class SyntheticUniverse {
+    #ifdef SWIG
+    %feature("kwargs") SyntheticUniverse;
+    #endif
+
+public:
+    SyntheticUniverse(int systems=8000, int entities=40, float degree=2.6, float density=0.02, int region_size=100, unsigned int seed=1) {
+        this->systems = systems;
+        this->entities = entities;
+        this->degree = degree;
+        this->density = density;
+        this->region_size = region_size;
+        this->seed = seed;
+    }
+
+    Universe *generate();
+
+    int systems, entities, region_size;
+    float degree, density;
+    unsigned int seed;
+};
@@ -1,14 +1,24 @@
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <map>
-#include <xmmintrin.h>
+#include <deque>
+#include <tuple>
+#include <mutex>
+#include <math.h>
 
 #include "parameters.hpp"
+#include "metrics.hpp"
+#include "offset_ptr.hpp"
 
 class Celestial;
 class System;
+class RegionRouter;
+class JumpGraph;
+class PrecomputeStore;
+class Workspace;
 
 enum entity_type {
     CELESTIAL, STATION, STARGATE
@@ -26,32 +36,132 @@ struct waypoint {
     float time, fatigue, reactivation, wait, distance;
 };
 
+/*
+ * Counters and timings of a single search. These are only filled in if the
+ * library was built with NERD_STATS, and are all zero otherwise. The relaxed
+ * counters count every edge considered, per movement type, and the times
+ * are wall clock seconds.
+ */
+struct search_stats {
+    long settled, heap_inserts, heap_decreases, heap_extracts;
+    long relaxed_warp, relaxed_gate, relaxed_jump;
+    long jump_scanned, jump_accepted;
+    double setup_time, search_time, path_time;
+};
+
+/*
+ * A change to the connections of a universe. Every change increments the
+ * generation of the universe by one and is recorded with the generation it
+ * resulted in, so that anything derived from an older generation can catch
+ * up by replaying them, see get_changes. Entities and systems are given by
+ * sequence id, and a change without a destination has -1 there. Removing a
+ * system is recorded with the system as the origin.
+ */
+enum graph_change_type {
+    CHANGE_STARGATE, CHANGE_STATIC_BRIDGE, CHANGE_DYNAMIC_BRIDGE, CHANGE_WORMHOLE, CHANGE_SYSTEM
+};
+
+struct graph_change {
+    int generation;
+    bool added;
+    enum graph_change_type type;
+    int src, dst;
+};
+
+class RouteBatch;
+
 class Route {
 public:
-    int loops;
+    int loops, edges;
     double cost;
     std::vector<struct waypoint> points;
+    struct search_stats stats;
 
     void concatenate(const Route& that) {
         cost += that.cost;
+        points.reserve(std::max(points.size() + that.points.size(), 2 * points.size()));
         points.insert(points.end(), that.points.begin(), that.points.end());
     }
+
+    RouteBatch *as_batch();
 };
 
+/*
+ * A flat, fixed layout copy of a waypoint, which foreign code can read
+ * directly. The Python module relies on this exact layout.
+ */
+struct route_record {
+    int entity_id, system_id, type;
+    float time, fatigue, reactivation, wait, distance;
+};
+
+/*
+ * Any number of routes stored as one contiguous array of records. The
+ * records of route i are those from offsets[i] up to offsets[i + 1], and a
+ * route which does not exist is empty with a cost of NaN. The addresses are
+ * exposed so that bindings can view the arrays without copying them; they
+ * are only valid for as long as the batch lives and is not appended to.
+ */
+class RouteBatch {
+public:
+    RouteBatch();
+
+    void append(Route *);
+    void clear();
+    int size();
+
+    unsigned long get_records_address();
+    unsigned long get_offsets_address();
+    unsigned long get_costs_address();
+
+    #ifndef SWIG
+    std::vector<struct route_record> records;
+    std::vector<int> offsets;
+    std::vector<double> costs;
+    #endif
+};
+
+/*
+ * The shortest travel time from one origin to every system, indexed by the
+ * sequence id of the system, along with the entity of the system which is
+ * reached soonest. Systems out of reach have an infinite time and no entity.
+ */
+class SystemDistances {
+public:
+    std::vector<float> times;
+    std::vector<Celestial *> entities;
+};
+
+/*
+ * Entities and systems only point at each other and at their names, which
+ * live in the universe, and do so through offset pointers. The tables can
+ * thus be mapped into other processes at any address, see export_shared.
+ */
 class Entity {
 public:
     float x, y, z;
     int id, seq_id;
-    std::string name;
+
+    #ifndef SWIG
+    offset_ptr<const char> name;
+    #endif
 };
 
 class Celestial: public Entity {
 public:
     enum entity_type type;
     int group_id;
+
+    #ifdef SWIG
     System *system;
     Celestial *destination;
     Celestial *bridge;
+    #else
+    offset_ptr<System> system;
+    offset_ptr<Celestial> destination;
+    offset_ptr<Celestial> bridge;
+    #endif
+
     float jump_range;
 
     bool is_relevant() {
@@ -69,9 +179,16 @@ public:
 
 class System: public Entity {
 public:
-    int entity_count;
+    int entity_count, region_id;
+
+    #ifdef SWIG
     Celestial *entities, *gates;
+    #else
+    offset_ptr<Celestial> entities, gates;
+    #endif
+
     float security;
+    bool removed;
 
     Celestial *get_entity_by_internal_id(int id) {
         return entities + id;
@@ -82,28 +199,81 @@ class Universe {
 public:
     Universe(FILE *, FILE *);
     Universe(std::string, std::string);
+    Universe(int, int);
     ~Universe();
 
-    void add_system(int, char *, double, double, double, unsigned int, float);
+    void export_shared(std::string);
+    static Universe *attach_shared(std::string);
+
+    void open_store(std::string);
+
+    /*
+     * Changes to the universe. They take no lock, so none of them may be
+     * made while routes are being found on another thread. That includes
+     * Python threads, since searches release the GIL.
+     */
+    void add_system(int, char *, double, double, double, unsigned int, float, int region=0);
     Celestial *add_entity(int, int, enum entity_type, char *, double, double, double, Celestial *);
 
+    void add_stargate(Celestial *, Celestial *);
+    void add_stargate(int, int);
+
     void add_dynamic_bridge(Celestial *, float);
     void add_dynamic_bridge(int, float);
 
     void add_static_bridge(Celestial *, Celestial *);
     void add_static_bridge(int, int);
 
+    void remove_stargate(Celestial *);
+    void remove_stargate(int);
+
+    void remove_dynamic_bridge(Celestial *);
+    void remove_dynamic_bridge(int);
+
+    void remove_static_bridge(Celestial *);
+    void remove_static_bridge(int);
+
+    void add_wormhole(Celestial *, Celestial *);
+    void add_wormhole(int, int);
+
+    void remove_wormhole(Celestial *);
+    void remove_wormhole(int);
+
+    void remove_system(int);
+
+    #ifndef SWIG
+    bool get_changes(int, std::vector<struct graph_change> *);
+    #endif
+
+    void sort_systems();
+
     #ifndef SWIG
     Route *get_route(int, int, Parameters *);
     Route *get_route(Celestial &, Celestial &, Parameters *);
     Route *get_route(std::vector<Celestial *>, Parameters *);
+    bool append_route(Celestial &, Celestial &, Parameters *, RouteBatch *);
     #endif
 
     Route *get_route(std::vector<int>, Parameters *);
+    RouteBatch *get_route_batch(std::vector<int>, std::vector<int>, Parameters *);
+
+    Route *get_hierarchical_route(int, int, Parameters *);
+    std::vector<Route *> get_alternative_routes(int, int, int, Parameters *);
+
+    #ifndef SWIG
+    Route *get_hierarchical_route(Celestial &, Celestial &, Parameters *);
+    std::vector<Route *> get_alternative_routes(Celestial &, Celestial &, int, Parameters *);
+    #endif
 
     std::map<Celestial *, float> *get_all_distances(int, Parameters *);
     std::map<Celestial *, float> *get_all_distances(Celestial &, Parameters *);
 
+    std::vector<float> get_reachable(int, float, Parameters *);
+    std::vector<float> get_reachable(Celestial &, float, Parameters *);
+
+    SystemDistances *get_system_distances(int, Parameters *, float max_seconds=INFINITY);
+    SystemDistances *get_system_distances(Celestial &, Parameters *, float max_seconds=INFINITY);
+
     Celestial *get_entity(int);
     System *get_system(int);
 
@@ -112,14 +282,76 @@ public:
 
     Celestial *get_entity_or_default(int);
 
-    int system_count = 0, entity_count = 0, stargate_count = 0;
+    /*
+     * Entities are indexed by their slot, and systems may reserve more slots
+     * than they fill, so arrays per entity need this many elements. Slots
+     * which are not filled have no system.
+     */
+    int get_entity_slots() {
+        return this->last_entity - this->entities;
+    }
+
+    std::string get_metrics_prometheus();
+    std::string get_metrics_json();
+    int get_id_map_size();
+
+    #ifndef SWIG
+    Workspace *acquire_workspace();
+    void release_workspace(Workspace *);
+    JumpGraph *get_jump_graph(float);
+    #endif
+
+    int get_workspace_count();
+    int get_workspaces_in_use();
+
+    int system_count = 0, entity_count = 0, stargate_count = 0, generation = 0;
+    int system_capacity = 0, entity_capacity = 0, sorted_systems = 0, max_system_entities = 0;
+    unsigned long names_size = 0;
+    bool read_only = false;
     System *systems;
     Celestial *entities;
 
+    #ifndef SWIG
+    Metrics metrics;
+    #endif
+
 private:
+    Universe();
+
+    void allocate(int, int);
+    void check_writable();
+    const char *store_name(const char *);
+    void record_change(bool, enum graph_change_type, int, int);
+    void connect_stargate(Celestial *, Celestial *);
+    void update_gates(System *);
     void initialise(FILE *, FILE *);
     void load_stargates(FILE *);
     void load_systems_and_entities(FILE *);
+    RegionRouter *get_region_router(Parameters *);
+    PrecomputeStore *get_store();
+    uint64_t get_checksum();
     Celestial *last_entity;
     std::map<int, int> entity_map, system_map;
+    std::deque<struct graph_change> journal;
+    std::map<std::tuple<float, float, float>, RegionRouter *> region_routers;
+    std::vector<RegionRouter *> retired_region_routers;
+    std::mutex region_router_lock;
+
+    std::map<float, JumpGraph *> jump_graphs;
+    std::vector<JumpGraph *> retired_jump_graphs;
+    std::mutex jump_graph_lock;
+
+    PrecomputeStore *store = NULL;
+    std::vector<PrecomputeStore *> retired_stores;
+    int store_generation = -1;
+
+    std::vector<Workspace *> workspaces;
+    std::mutex workspace_lock;
+    int workspace_count = 0;
+
+    std::vector<char *> name_blocks;
+    char *name_next = NULL, *name_end = NULL;
+
+    void *mapping = NULL;
+    unsigned long mapping_size = 0;
 };
@@ -0,0 +1,132 @@
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.hpp"
+#include "protocol.hpp"
+
+/*
+ * At most this many lines are read but not yet written, whether they are
+ * queued, being routed, or waiting for earlier lines to be written.
+ */
+#define BATCH_WINDOW 4096
+
+struct batch {
+    Universe *universe;
+    const Parameters *parameters;
+    bool hierarchical, ordered;
+    FILE *out;
+
+    std::mutex lock;
+    std::condition_variable available, space;
+    std::deque<std::pair<long, std::string>> jobs;
+    std::map<long, std::string> responses;
+    long written;
+    bool done;
+
+    struct batch_stats *stats;
+};
+
+/*
+ * Writes a response, or holds it back until all earlier ones are written if
+ * the output is ordered. Must be called with the lock held.
+ */
+static void write_response(struct batch *b, long sequence, std::string &response) {
+    if (!b->ordered) {
+        fputs(response.c_str(), b->out);
+        b->written++;
+    } else {
+        b->responses[sequence].swap(response);
+
+        while (!b->responses.empty() && b->responses.begin()->first == b->written) {
+            fputs(b->responses.begin()->second.c_str(), b->out);
+            b->responses.erase(b->responses.begin());
+            b->written++;
+        }
+    }
+
+    b->space.notify_one();
+}
+
+static void work(struct batch *b) {
+    std::unique_lock<std::mutex> guard(b->lock);
+    enum request_result result;
+
+    while (1) {
+        b->available.wait(guard, [b]() { return b->done || !b->jobs.empty(); });
+
+        if (b->jobs.empty()) return;
+
+        std::pair<long, std::string> job;
+        job.swap(b->jobs.front());
+        b->jobs.pop_front();
+
+        guard.unlock();
+        std::string response = handle_request(*b->universe, job.second.c_str(), *b->parameters, b->hierarchical, &result);
+        guard.lock();
+
+        b->stats->count++;
+        if (result == REQUEST_FOUND) b->stats->found++;
+        if (result == REQUEST_FAILED) b->stats->failed++;
+
+        write_response(b, job.first, response);
+    }
+}
+
+void run_batch(Universe &u, FILE *in, FILE *out, const Parameters &parameters, bool hierarchical, int threads, bool ordered, struct batch_stats *stats) {
+    struct batch b;
+    std::vector<std::thread> workers;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t n;
+    long sequence = 0;
+
+    b.universe = &u;
+    b.parameters = &parameters;
+    b.hierarchical = hierarchical;
+    b.ordered = ordered;
+    b.out = out;
+    b.written = 0;
+    b.done = false;
+    b.stats = stats;
+
+    for (int i = 0; i < threads; i++) {
+        workers.push_back(std::thread(work, &b));
+    }
+
+    while ((n = getline(&line, &size, in)) >= 0) {
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) line[--n] = '\0';
+
+        if (strspn(line, " \t") == (size_t) n) continue;
+
+        {
+            std::unique_lock<std::mutex> guard(b.lock);
+
+            b.space.wait(guard, [&]() { return sequence - b.written < BATCH_WINDOW; });
+            b.jobs.push_back(std::make_pair(sequence++, std::string(line, n)));
+        }
+
+        b.available.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(b.lock);
+        b.done = true;
+    }
+
+    b.available.notify_all();
+
+    for (auto &w : workers) {
+        w.join();
+    }
+
+    free(line);
+    fflush(out);
+}
@@ -1,41 +1,52 @@
+#include <algorithm>
 #include <array>
-#include <list>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <time.h>
 #include <math.h>
-#include <omp.h>
-
-#include <xmmintrin.h>
-#include <pmmintrin.h>
 
 #include "dijkstra.hpp"
+#include "jump_graph.hpp"
+#include "kernels.hpp"
 #include "min_heap.hpp"
 #include "universe.hpp"
 
-#define AU_TO_M 149597870700.0
-#define LY_TO_M 9460730472580800.0
-
-#if defined(__AVX__)
-#include <immintrin.h>
-#define VECTOR_WIDTH 8
-typedef __m256 vector_type;
-#elif defined(__SSE__)
-#define VECTOR_WIDTH 4
-typedef __m128 vector_type;
+/*
+ * Alternative routes may take at most this factor longer than the shortest,
+ * every route makes the systems it goes through this fraction of an average
+ * system along the shortest route more expensive, and the search gives up
+ * after this many attempts per route asked for.
+ */
+#define ALTERNATIVE_STRETCH 1.5
+#define ALTERNATIVE_DETOUR 0.5
+#define ALTERNATIVE_ATTEMPTS 3
+
+/*
+ * Search statistics are compiled out unless NERD_STATS is defined.
+ */
+#ifdef NERD_STATS
+#define STAT_ADD(field, n) stats.field += (n)
+#define STAT_TIME(field, start) stats.field += seconds_since(&start)
+#define STAT_START(start) struct timespec start; clock_gettime(CLOCK_MONOTONIC, &start)
+
+static double seconds_since(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1E9;
+}
 #else
-#error "Here's a nickel kid, buy yourself a real computer."
+#define STAT_ADD(field, n)
+#define STAT_TIME(field, start)
+#define STAT_START(start)
 #endif
 
-inline float __attribute__((always_inline)) entity_distance(Celestial *a, Celestial *b) {
-    if (a->system != b->system) return INFINITY;
-
-    float dx = a->x - b->x;
-    float dy = a->y - b->y;
-    float dz = a->z - b->z;
-
-    return sqrt(dx * dx + dy * dy + dz * dz);
+/*
+ * Jumps land on the stations, stargates and beacons of a system, which are
+ * stored from the gates pointer onward. Systems without any land nowhere.
+ */
+inline int __attribute__((always_inline)) get_landing_offset(System *sys) {
+    return sys->gates ? sys->gates - sys->entities : sys->entity_count;
 }
 
 inline float __attribute__((always_inline)) system_distance(System *a, System *b) {
@@ -46,9 +57,7 @@ inline float __attribute__((always_inline)) system_distance(System *a, System *b
     return sqrt(dx * dx + dy * dy + dz * dz);
 }
 
-float Dijkstra::get_time(float distance) {
-    float v_wrp = parameters->warp_speed;
-
+float Dijkstra::get_time(float v_wrp, float distance) {
     float k_accel = v_wrp;
     float k_decel = (v_wrp / 3) < 2 ? (v_wrp / 3) : 2;
 
@@ -70,161 +79,353 @@ float Dijkstra::get_time(float distance) {
     return cruise_time + t_accel + t_decel;
 }
 
+Workspace::Workspace(Universe &u) {
+    this->systems = u.system_count;
+    this->entities = u.get_entity_slots();
+    this->max_entities = u.max_system_entities;
+    this->generation = -1;
+
+    this->prev = new int[entities];
+    this->vist = new int[entities];
+    this->cost = new float[entities];
+    this->type = new enum movement_type[entities];
+
+    this->sys_x = new float[systems];
+    this->sys_y = new float[systems];
+    this->sys_z = new float[systems];
+
+    this->sys_blocked = new bool[systems];
+    this->sys_penalty = new float[systems];
+    this->penalty = new float[entities];
+
+    this->fatigue = new float[entities];
+    this->reactivation = new float[entities];
+    this->wait = new float[entities];
+    this->distance = new float[entities];
+
+    this->warp_x = new float[max_entities];
+    this->warp_y = new float[max_entities];
+    this->warp_z = new float[max_entities];
+    this->warp_time = new float[max_entities];
+    this->warp_targets = new Celestial *[max_entities];
+
+    this->queue = new MinHeap<float, int>(entities);
+}
+
+Workspace::~Workspace() {
+    delete[] prev;
+    delete[] cost;
+    delete[] vist;
+    delete[] type;
+
+    delete[] wait;
+    delete[] distance;
+    delete[] fatigue;
+    delete[] reactivation;
+
+    delete queue;
+
+    delete[] sys_x;
+    delete[] sys_y;
+    delete[] sys_z;
+
+    delete[] sys_blocked;
+    delete[] sys_penalty;
+    delete[] penalty;
+
+    delete[] warp_x;
+    delete[] warp_y;
+    delete[] warp_z;
+    delete[] warp_time;
+    delete[] warp_targets;
+}
+
+bool Workspace::fits(Universe &u) {
+    return systems == u.system_count && entities == u.get_entity_slots() && max_entities >= u.max_system_entities;
+}
+
 Dijkstra::Dijkstra(Universe &u, Celestial *src, Celestial *dst, Parameters *parameters) : universe(u) {
+    STAT_START(start);
+
     this->src = src;
     this->dst = dst;
     this->parameters = parameters;
+    this->pooled = true;
 
-    this->prev = new int[this->universe.entity_count];
-    this->vist = new int[this->universe.entity_count];
-    this->cost = new float[this->universe.entity_count];
-    this->type = new enum movement_type[this->universe.entity_count];
-
-    this->sys_x = new float[this->universe.system_count + VECTOR_WIDTH];
-    this->sys_y = new float[this->universe.system_count + VECTOR_WIDTH];
-    this->sys_z = new float[this->universe.system_count + VECTOR_WIDTH];
-
-    this->fatigue = new float[this->universe.entity_count];
-    this->reactivation = new float[this->universe.entity_count];
-    this->wait = new float[this->universe.entity_count];
-    this->distance = new float[this->universe.entity_count];
+    attach(u.acquire_workspace());
+    initialise();
 
-    this->queue = new MinHeap<float, int>(u.entity_count);
+    STAT_TIME(setup_time, start);
+}
 
-    for (int i = 0; i < this->universe.system_count; i++) {
-        sys_x[i] = this->universe.systems[i].x;
-        sys_y[i] = this->universe.systems[i].y;
-        sys_z[i] = this->universe.systems[i].z;
-    }
+/*
+ * Resumes a search from the state left in a workspace of its own, which is
+ * not returned to the pool, see DistanceTree.
+ */
+Dijkstra::Dijkstra(Universe &u, Celestial *src, Parameters *parameters, Workspace *w) : universe(u) {
+    this->src = src;
+    this->dst = NULL;
+    this->parameters = parameters;
+    this->pooled = false;
 
-    for (int i = 0; i < this->universe.entity_count; i++) {
+    attach(w);
+}
 
+void Dijkstra::initialise() {
+    for (int i = 0; i < this->workspace->entities; i++) {
         vist[i] = i == src->seq_id ? 1 : 0;
         prev[i] = i == src->seq_id ? -2 : -1;
         type[i] = STRT;
         cost[i] = i == src->seq_id ? 0.0 : INFINITY;
 
+        penalty[i] = 0.0;
         fatigue[i] = 0.0;
         reactivation[i] = 0.0;
+        wait[i] = 0.0;
+        distance[i] = NAN;
+
+        if (this->universe.entities[i].system == NULL) continue;
 
-        if (celestial_is_relevant(this->universe.entities[i])) {
-            queue->insert(cost[i], i);
+        if (celestial_is_relevant(this->universe.entities[i]) && !sys_blocked[this->universe.entities[i].system->seq_id]) {
+            queue->insert(heuristic ? cost[i] + heuristic[i] : cost[i], i);
+            STAT_ADD(heap_inserts, 1);
         }
     }
 }
 
+void Dijkstra::attach(Workspace *w) {
+    this->workspace = w;
+
+    this->prev = w->prev;
+    this->vist = w->vist;
+    this->cost = w->cost;
+    this->type = w->type;
+
+    this->sys_x = w->sys_x;
+    this->sys_y = w->sys_y;
+    this->sys_z = w->sys_z;
+
+    this->sys_blocked = w->sys_blocked;
+    this->sys_penalty = w->sys_penalty;
+    this->penalty = w->penalty;
+
+    this->fatigue = w->fatigue;
+    this->reactivation = w->reactivation;
+    this->wait = w->wait;
+    this->distance = w->distance;
+
+    this->warp_x = w->warp_x;
+    this->warp_y = w->warp_y;
+    this->warp_z = w->warp_z;
+    this->warp_time = w->warp_time;
+    this->warp_targets = w->warp_targets;
+
+    this->queue = w->queue;
+
+    if (w->generation != universe.generation) {
+        for (int i = 0; i < this->universe.system_count; i++) {
+            sys_x[i] = this->universe.systems[i].x;
+            sys_y[i] = this->universe.systems[i].y;
+            sys_z[i] = this->universe.systems[i].z;
+        }
+
+        w->generation = universe.generation;
+    }
+
+    compile_constraints();
+
+    jump_graph = NULL;
+
+    if (parameters->use_jump_graph && !isnan(parameters->jump_range)) {
+        jump_graph = universe.get_jump_graph(parameters->jump_range);
+    }
+}
+
 Dijkstra::~Dijkstra() {
-    delete[] prev;
-    delete[] cost;
-    delete[] vist;
-    delete[] type;
+    queue->clear();
+    if (pooled) universe.release_workspace(workspace);
+}
 
-    delete[] wait;
-    delete[] distance;
+void Dijkstra::compile_constraints() {
+    System *sys;
 
-    delete[] sys_x;
-    delete[] sys_y;
-    delete[] sys_z;
+    for (int i = 0; i < this->universe.system_count; i++) {
+        sys = &this->universe.systems[i];
+
+        sys_blocked[i] = sys->removed ||
+                         (!isnan(parameters->min_security) && sys->security < parameters->min_security) ||
+                         (!isnan(parameters->max_security) && sys->security > parameters->max_security);
+        sys_penalty[i] = parameters->security_penalty * std::min(std::max(1 - sys->security, 0.f), 1.f);
+
+        for (auto const& region : parameters->avoided_regions) {
+            if (sys->region_id == region) sys_blocked[i] = true;
+        }
+    }
+
+    for (auto const& id : parameters->avoided_systems) {
+        if ((sys = this->universe.get_system(id)) != NULL) sys_blocked[sys->seq_id] = true;
+    }
+
+    sys_blocked[src->system->seq_id] = false;
+    if (dst) sys_blocked[dst->system->seq_id] = false;
 }
 
 bool Dijkstra::celestial_is_relevant(Celestial &c) {
     return c.is_relevant() || c.id == src->id || (dst && c.id == dst->id);
 }
 
+/*
+ * Whether a solver for the given movement follows stargates and jumps with
+ * the ship's own drive. The generic solver asks the parameters every time,
+ * the specialised ones know at compile time.
+ */
+#define USES_GATES(M) ((M) == SOLVE_ANY ? !isnan(parameters->gate_cost) : (M) != SOLVE_JUMPS)
+#define USES_DRIVE(M) ((M) == SOLVE_ANY ? !isnan(parameters->jump_range) : (M) != SOLVE_GATES)
+
+template <int M, int F>
 void Dijkstra::solve_w_set(Celestial *ent) {
     System *sys = ent->system;
+    int n = 0;
 
     for (int i = 0; i < sys->entity_count; i++) {
         if (!celestial_is_relevant(sys->entities[i]) || ent == &sys->entities[i]) {
             continue;
         }
 
-        update_administration(ent, &sys->entities[i], parameters->align_time + get_time(entity_distance(ent, &sys->entities[i])), WARP);
+        warp_targets[n] = &sys->entities[i];
+        warp_x[n] = sys->entities[i].x;
+        warp_y[n] = sys->entities[i].y;
+        warp_z[n] = sys->entities[i].z;
+        n++;
+    }
+
+    get_time_batch(parameters->warp_speed, ent->x, ent->y, ent->z, warp_x, warp_y, warp_z, warp_time, n);
+
+    for (int i = 0; i < n; i++) {
+        update_administration<F>(ent, warp_targets[i], parameters->align_time + warp_time[i], WARP);
     }
 }
 
+template <int M, int F>
 void Dijkstra::solve_g_set(Celestial *ent) {
-    if (ent->destination && !isnan(parameters->gate_cost)) {
-        update_administration(ent, ent->destination, parameters->gate_cost, GATE);
+    if (USES_GATES(M) && ent->destination) {
+        update_administration<F>(ent, ent->destination, parameters->gate_cost, GATE);
     }
 }
 
+template <int M, int F>
 void Dijkstra::solve_r_set(Celestial *ent) {
-    if (ent->bridge && isnan(parameters->jump_range)) {
-        update_administration(ent, ent->bridge, system_distance(ent->system, ent->bridge->system) * (1 - parameters->jump_range_reduction), JUMP);
+    if (!USES_DRIVE(M) && ent->bridge) {
+        update_administration<F>(ent, ent->bridge, system_distance(ent->system, ent->bridge->system) * (1 - parameters->jump_range_reduction), JUMP);
     }
 }
 
+template <int M, int F>
 void Dijkstra::solve_j_set(Celestial *ent) {
-    vector_type x_vec, y_vec, z_vec;
-    vector_type x_src_vec, y_src_vec, z_src_vec;
+    System *sys = ent->system;
 
+    float range, range_sq, slab;
+    int sorted = this->universe.sorted_systems, lo, hi;
+
+    if (USES_DRIVE(M) && jump_graph) {
+        for (int e = jump_graph->offsets[sys->seq_id]; e < jump_graph->offsets[sys->seq_id + 1]; e++) {
+            System *jsys = this->universe.systems + jump_graph->targets[e];
+
+            if (sys_blocked[jsys->seq_id]) continue;
+
+            STAT_ADD(jump_accepted, 1);
+
+            for (int j = ((dst && jsys != dst->system) ? get_landing_offset(jsys) : 0); j < jsys->entity_count; j++) {
+                update_administration<F>(ent, &jsys->entities[j], jump_graph->distances[e] * (1 - parameters->jump_range_reduction), JUMP);
+            }
+        }
+    } else if (USES_DRIVE(M) ? !isnan((range = parameters->jump_range)) : !isnan((range = ent->jump_range))) {
+        range_sq = pow(range * LY_TO_M, 2.0);
+
+        /*
+         * Systems are sorted by x, so only those in the slab [x - r, x + r]
+         * can be in range. The slab is widened slightly to be safe against
+         * rounding, and aligned down to the widest SIMD vector.
+         */
+        slab = range * LY_TO_M * 1.0001;
+
+        lo = std::lower_bound(sys_x, sys_x + sorted, sys->x - slab) - sys_x;
+        hi = std::upper_bound(sys_x, sys_x + sorted, sys->x + slab) - sys_x;
+
+        solve_j_range<F>(ent, lo & ~15, hi, range_sq);
+        solve_j_range<F>(ent, sorted, this->universe.system_count, range_sq);
+    }
+}
+
+template <int F>
+void Dijkstra::solve_j_range(Celestial *ent, int begin, int end, float range_sq) {
     System *jsys, *sys = ent->system;
 
     float distance;
-    float range, range_sq;
-
-    #if VECTOR_WIDTH == 4
-    x_src_vec = _mm_set1_ps(sys->x);
-    y_src_vec = _mm_set1_ps(sys->y);
-    z_src_vec = _mm_set1_ps(sys->z);
-    #elif VECTOR_WIDTH == 8
-    x_src_vec = _mm256_set1_ps(sys->x);
-    y_src_vec = _mm256_set1_ps(sys->y);
-    z_src_vec = _mm256_set1_ps(sys->z);
-    #endif
 
-    if (!isnan((range = parameters->jump_range)) || !isnan((range = ent->jump_range))) {
-        range_sq = pow(range * LY_TO_M, 2.0);
+    for (int k = begin; k < end; k += JUMP_CHUNK) {
+        int candidates[JUMP_CHUNK], count;
+        float distance_sq[JUMP_CHUNK];
 
-        #pragma omp for schedule(guided)
-        for (int k = 0; k < this->universe.system_count; k += VECTOR_WIDTH) {
-            #if VECTOR_WIDTH == 4
-            x_vec = _mm_load_ps(sys_x + k);
-            y_vec = _mm_load_ps(sys_y + k);
-            z_vec = _mm_load_ps(sys_z + k);
-            #elif VECTOR_WIDTH == 8
-            x_vec = _mm256_loadu_ps(sys_x + k);
-            y_vec = _mm256_loadu_ps(sys_y + k);
-            z_vec = _mm256_loadu_ps(sys_z + k);
-            #endif
-
-            x_vec -= x_src_vec;
-            y_vec -= y_src_vec;
-            z_vec -= z_src_vec;
-
-            x_vec = (x_vec * x_vec) + (y_vec * y_vec) + (z_vec * z_vec);
-
-            for (int i = 0; i < VECTOR_WIDTH; i++) {
-                if (x_vec[i] > range_sq ||
-                    k + i >= this->universe.system_count ||
-                    sys == (jsys = this->universe.systems + i + k) ||
-                    jsys->security >= 0.5) continue;
-
-                distance = sqrt(x_vec[i]) / LY_TO_M;
-
-                for (int j = ((dst && jsys != dst->system) ? jsys->gates - jsys->entities : 0); j < jsys->entity_count; j++) {
-                    update_administration(ent, &jsys->entities[j], distance * (1 - parameters->jump_range_reduction), JUMP);
-                }
+        count = get_jump_candidates(
+            sys_x + k, sys_y + k, sys_z + k, std::min(JUMP_CHUNK, end - k),
+            sys->x, sys->y, sys->z, range_sq, candidates, distance_sq
+        );
+
+        STAT_ADD(jump_scanned, std::min(JUMP_CHUNK, end - k));
+
+        for (int i = 0; i < count; i++) {
+            if (sys == (jsys = this->universe.systems + k + candidates[i]) ||
+                jsys->security >= 0.5 ||
+                sys_blocked[jsys->seq_id]) continue;
+
+            STAT_ADD(jump_accepted, 1);
+            distance = sqrt(distance_sq[i]) / LY_TO_M;
+
+            for (int j = ((dst && jsys != dst->system) ? get_landing_offset(jsys) : 0); j < jsys->entity_count; j++) {
+                update_administration<F>(ent, &jsys->entities[j], distance * (1 - parameters->jump_range_reduction), JUMP);
             }
         }
     }
 }
 
-void Dijkstra::update_administration(Celestial *a, Celestial *b, float ccost, enum movement_type ctype) {
-    float dcost, cur_cost, wait_cost = 0.0;
+/*
+ * The kind of connection is always known at the call site, and the fatigue
+ * model is either a template argument or ANY_FATIGUE for the generic solver,
+ * so once this is inlined only the branches which apply are left.
+ */
+template <int F>
+inline void __attribute__((always_inline)) Dijkstra::update_administration(Celestial *a, Celestial *b, float ccost, enum movement_type ctype) {
+    enum fatigue_model model = F == ANY_FATIGUE ? parameters->fatigue_model : (enum fatigue_model) F;
+    float dcost, cur_cost, wait_cost = 0.0, pcost = 0.0;
+
+    if (sys_blocked[b->system->seq_id]) return;
+
+    edges++;
+
+    #ifdef NERD_STATS
+    if (ctype == WARP) {
+        STAT_ADD(relaxed_warp, 1);
+    } else if (ctype == GATE) {
+        STAT_ADD(relaxed_gate, 1);
+    } else {
+        STAT_ADD(relaxed_jump, 1);
+    }
+    #endif
+
+    if (a->system != b->system) pcost = sys_penalty[b->system->seq_id];
 
     if (ctype == JUMP) {
-        if (parameters->fatigue_model == FATIGUE_IGNORE) {
+        if (model == FATIGUE_IGNORE) {
             dcost = 10.0;
-        } else if (parameters->fatigue_model == FATIGUE_REACTIVATION_COST) {
+        } else if (model == FATIGUE_REACTIVATION_COST) {
             dcost = 60 * (ccost + 1);
-        } else if (parameters->fatigue_model == FATIGUE_FATIGUE_COST) {
+        } else if (model == FATIGUE_FATIGUE_COST) {
             dcost = 600 * ccost;
-        } else if (parameters->fatigue_model == FATIGUE_REACTIVATION_COUNTDOWN) {
+        } else if (model == FATIGUE_REACTIVATION_COUNTDOWN) {
             wait_cost = reactivation[a->seq_id];
             dcost = wait_cost + 10.0;
-        } else if (parameters->fatigue_model == FATIGUE_FATIGUE_COUNTDOWN) {
+        } else if (model == FATIGUE_FATIGUE_COUNTDOWN) {
             wait_cost = std::max(fatigue[a->seq_id] - 600, 0.f);
             dcost = wait_cost + 10.0;
         } else {
@@ -234,27 +435,33 @@ void Dijkstra::update_administration(Celestial *a, Celestial *b, float ccost, en
         dcost = ccost;
     }
 
-    cur_cost = cost[a->seq_id] + dcost;
+    cur_cost = cost[a->seq_id] + dcost + pcost;
 
-    if (cur_cost <= cost[b->seq_id] && !vist[b->seq_id]) {
-        #pragma omp critical
-        {
-            queue->decrease_raw(cur_cost, b->seq_id);
-            prev[b->seq_id] = a->seq_id;
-            cost[b->seq_id] = cur_cost;
-            type[b->seq_id] = ctype;
-            wait[b->seq_id] = wait_cost;
+    if (repairing ? cur_cost < cost[b->seq_id] : cur_cost <= cost[b->seq_id] && !vist[b->seq_id]) {
+        float key = heuristic ? cur_cost + heuristic[b->seq_id] : cur_cost;
 
-            fatigue[b->seq_id] = std::max(fatigue[a->seq_id] - dcost, 0.f);
-            reactivation[b->seq_id] = std::max(reactivation[a->seq_id] - dcost, 0.f);
+        if (!repairing || queue->contains(b->seq_id)) {
+            queue->decrease_raw(key, b->seq_id);
+        } else if (celestial_is_relevant(*b)) {
+            queue->insert(key, b->seq_id);
+        }
 
-            if (ctype == JUMP) {
-                fatigue[b->seq_id] = std::min(60*60*24*7.f, std::max((fatigue[a->seq_id] - wait_cost), 600.f) * (ccost + 1));
-                reactivation[b->seq_id] = std::max((fatigue[a->seq_id] - wait_cost) / 10, 60 * (ccost + 1));
-                distance[b->seq_id] = ccost;
-            } else {
-                distance[b->seq_id] = NAN;
-            }
+        STAT_ADD(heap_decreases, 1);
+        prev[b->seq_id] = a->seq_id;
+        cost[b->seq_id] = cur_cost;
+        penalty[b->seq_id] = penalty[a->seq_id] + pcost;
+        type[b->seq_id] = ctype;
+        wait[b->seq_id] = wait_cost;
+
+        fatigue[b->seq_id] = std::max(fatigue[a->seq_id] - dcost, 0.f);
+        reactivation[b->seq_id] = std::max(reactivation[a->seq_id] - dcost, 0.f);
+
+        if (ctype == JUMP) {
+            fatigue[b->seq_id] = std::min(60*60*24*7.f, std::max((fatigue[a->seq_id] - wait_cost), 600.f) * (ccost + 1));
+            reactivation[b->seq_id] = std::max((fatigue[a->seq_id] - wait_cost) / 10, 60 * (ccost + 1));
+            distance[b->seq_id] = ccost;
+        } else {
+            distance[b->seq_id] = NAN;
         }
     }
 }
@@ -265,36 +472,121 @@ Route *Dijkstra::get_route() {
 }
 
 Route *Dijkstra::get_route(Celestial *dst) {
-    std::list<struct waypoint> points_tmp;
-
+    STAT_START(start);
     solve_internal();
+    STAT_TIME(search_time, start);
+
+    if (!vist[dst->seq_id] || isinf(cost[dst->seq_id])) return NULL;
+
+    return get_path(dst);
+}
+
+int Dijkstra::get_path_length(Celestial *dst) {
+    int n = 0;
+
+    for (int c = dst->seq_id; c != -2; c = prev[c]) n++;
+
+    return n;
+}
 
-    if (!vist[dst->seq_id]) return NULL;
+/*
+ * Follows the search tree back from an entity it reached. The path is
+ * counted first, so that the waypoints can be written back to front into
+ * an array of the right size.
+ */
+Route *Dijkstra::get_path(Celestial *dst) {
+    STAT_START(path_start);
 
     Route *route = new Route();
+    int n = get_path_length(dst);
 
     route->loops = loops;
-    route->cost = cost[dst->seq_id];
+    route->edges = edges;
+    route->cost = cost[dst->seq_id] - penalty[dst->seq_id];
+    route->points.resize(n);
 
     for (int c = dst->seq_id; c != -2; c = prev[c]) {
-        points_tmp.push_front((struct waypoint) {
+        route->points[--n] = (struct waypoint) {
             .entity = &this->universe.entities[c],
             .type = type[c],
-            .time = cost[c],
+            .time = cost[c] - penalty[c],
             .fatigue = fatigue[c],
             .reactivation = reactivation[c],
             .wait = wait[c],
             .distance = distance[c],
-        });
+        };
     }
 
-    for (auto i = points_tmp.begin(); i != points_tmp.end(); i++) {
-        route->points.push_back(*i);
-    }
+    STAT_TIME(path_time, path_start);
+    route->stats = stats;
 
     return route;
 }
 
+/*
+ * Searches for the destination and appends the route to a batch, or an
+ * empty route if there is none, straight from the search tree. Nothing is
+ * allocated once the batch has grown large enough.
+ */
+bool Dijkstra::append_route(RouteBatch *batch) {
+    Celestial *ent;
+    int n, start = batch->records.size();
+
+    solve_internal();
+
+    if (!vist[dst->seq_id] || isinf(cost[dst->seq_id])) {
+        batch->offsets.push_back(start);
+        batch->costs.push_back(NAN);
+        return false;
+    }
+
+    n = get_path_length(dst);
+    batch->records.resize(start + n);
+
+    for (int c = dst->seq_id; c != -2; c = prev[c]) {
+        ent = &this->universe.entities[c];
+
+        batch->records[start + --n] = (struct route_record) {
+            .entity_id = ent->id,
+            .system_id = ent->system->id,
+            .type = type[c],
+            .time = cost[c] - penalty[c],
+            .fatigue = fatigue[c],
+            .reactivation = reactivation[c],
+            .wait = wait[c],
+            .distance = distance[c],
+        };
+    }
+
+    batch->offsets.push_back(batch->records.size());
+    batch->costs.push_back(cost[dst->seq_id] - penalty[dst->seq_id]);
+
+    return true;
+}
+
+/*
+ * Searches without a destination only warp to the entities which lead
+ * somewhere. Any other entity is reached afterwards, by warping to it from
+ * everything the search reached in its system.
+ */
+void Dijkstra::reach(Celestial *c) {
+    System *sys = c->system;
+    Celestial *ent;
+
+    for (int i = 0; i < sys->entity_count; i++) {
+        ent = &sys->entities[i];
+
+        if (ent == c || !vist[ent->seq_id] || isinf(cost[ent->seq_id])) continue;
+
+        warp_x[0] = c->x;
+        warp_y[0] = c->y;
+        warp_z[0] = c->z;
+
+        get_time_batch(parameters->warp_speed, ent->x, ent->y, ent->z, warp_x, warp_y, warp_z, warp_time, 1);
+        update_administration<ANY_FATIGUE>(ent, c, parameters->align_time + warp_time[0], WARP);
+    }
+}
+
 std::map<Celestial *, float> *Dijkstra::get_all_distances() {
     solve_internal();
 
@@ -302,38 +594,474 @@ std::map<Celestial *, float> *Dijkstra::get_all_distances() {
 
     if (dst != NULL) throw 10;
 
-    for (int i = 0; i < universe.entity_count; i++) {
+    for (int i = 0; i < workspace->entities; i++) {
         if (isfinite(cost[i])) {
-            res->emplace(&universe.entities[i], cost[i]);
+            res->emplace(&universe.entities[i], cost[i] - penalty[i]);
         }
     }
 
     return res;
 }
 
+/*
+ * The least a jump of the given length can cost, which is what it costs
+ * without any fatigue or reactivation left from earlier jumps.
+ */
+float Dijkstra::get_jump_bound(float ccost) {
+    switch (parameters->fatigue_model) {
+        case FATIGUE_IGNORE:
+        case FATIGUE_REACTIVATION_COUNTDOWN:
+        case FATIGUE_FATIGUE_COUNTDOWN:
+            return 10.0;
+        case FATIGUE_REACTIVATION_COST:
+            return 60 * (ccost + 1);
+        case FATIGUE_FATIGUE_COST:
+            return 600 * ccost;
+        default:
+            return INFINITY;
+    }
+}
+
+/*
+ * Searches backwards from the destination, over the same connections as the
+ * solver but with every jump at its lowest possible cost, for a lower bound
+ * on the cost from every entity to the destination. The search stops once
+ * it is the given factor beyond the origin, and everything it did not reach
+ * is at least that far away. Jumps cost the same into every entity of a
+ * system, so they are only followed back from the first entity of every
+ * system the search reaches.
+ */
+void Dijkstra::solve_reverse(std::vector<float> *h, float factor) {
+    int n = this->workspace->entities, sorted = this->universe.sorted_systems;
+    std::vector<int> into(n, -1), next(n, -1);
+    std::vector<char> done(n, 0), jumped(this->universe.system_count, 0);
+    std::vector<Celestial *> beacons;
+    MinHeap<float, int> heap(n);
+    float radius = 0, limit = INFINITY, range, ccost;
+    bool exhausted = true;
+    Celestial *ent;
+    System *sys, *jsys;
+
+    for (int i = 0; i < n; i++) {
+        ent = &this->universe.entities[i];
+
+        if (ent->system == NULL) continue;
+
+        if (ent->destination) {
+            next[i] = into[ent->destination->seq_id];
+            into[ent->destination->seq_id] = i;
+        }
+
+        if (!isnan(ent->jump_range)) beacons.push_back(ent);
+    }
+
+    auto relax = [&](Celestial *c, float value) {
+        int i = c->seq_id;
+
+        if (done[i] || value >= (*h)[i] || sys_blocked[c->system->seq_id] || !celestial_is_relevant(*c)) return;
+
+        (*h)[i] = value;
+
+        if (heap.contains(i)) {
+            heap.decrease_raw(value, i);
+        } else {
+            heap.insert(value, i);
+        }
+    };
+
+    h->assign(n, INFINITY);
+    (*h)[dst->seq_id] = 0;
+    heap.insert(0, dst->seq_id);
+
+    while (!heap.is_empty()) {
+        int x = heap.extract();
+
+        ent = &this->universe.entities[x];
+        sys = ent->system;
+        radius = (*h)[x];
+        done[x] = 1;
+
+        if (radius > limit) {
+            exhausted = false;
+            break;
+        }
+
+        if (ent == src) limit = radius * factor;
+
+        int m = 0;
+
+        for (int i = 0; i < sys->entity_count; i++) {
+            if (!celestial_is_relevant(sys->entities[i]) || ent == &sys->entities[i]) continue;
+
+            warp_targets[m] = &sys->entities[i];
+            warp_x[m] = sys->entities[i].x;
+            warp_y[m] = sys->entities[i].y;
+            warp_z[m] = sys->entities[i].z;
+            m++;
+        }
+
+        get_time_batch(parameters->warp_speed, ent->x, ent->y, ent->z, warp_x, warp_y, warp_z, warp_time, m);
+
+        for (int i = 0; i < m; i++) {
+            relax(warp_targets[i], radius + parameters->align_time + warp_time[i]);
+        }
+
+        for (int g = into[x]; g != -1 && !isnan(parameters->gate_cost); g = next[g]) {
+            Celestial *c = &this->universe.entities[g];
+            relax(c, radius + parameters->gate_cost + (c->system != sys ? sys_penalty[sys->seq_id] : 0));
+        }
+
+        if (ent->bridge && ent->bridge->bridge == ent && isnan(parameters->jump_range)) {
+            ccost = system_distance(ent->bridge->system, sys) * (1 - parameters->jump_range_reduction);
+            relax(ent->bridge, radius + get_jump_bound(ccost) + sys_penalty[sys->seq_id]);
+        }
+
+        if (jumped[sys->seq_id] || sys->security >= 0.5 || (sys != dst->system && ent - sys->entities < get_landing_offset(sys))) continue;
+
+        jumped[sys->seq_id] = 1;
+
+        if (!isnan(range = parameters->jump_range)) {
+            float slab = range * LY_TO_M * 1.0001;
+            int lo = std::lower_bound(sys_x, sys_x + sorted, sys->x - slab) - sys_x;
+            int hi = std::upper_bound(sys_x, sys_x + sorted, sys->x + slab) - sys_x;
+
+            int ranges[2][2] = { { lo & ~15, hi }, { sorted, this->universe.system_count } };
+
+            for (auto const& r : ranges) {
+                for (int k = r[0]; k < r[1]; k++) {
+                    jsys = &this->universe.systems[k];
+
+                    float distance = system_distance(jsys, sys) / LY_TO_M;
+
+                    if (jsys == sys || distance > range * 1.0001) continue;
+
+                    ccost = distance * (1 - parameters->jump_range_reduction);
+
+                    for (int j = 0; j < jsys->entity_count; j++) {
+                        relax(&jsys->entities[j], radius + get_jump_bound(ccost) + sys_penalty[sys->seq_id]);
+                    }
+                }
+            }
+        } else {
+            for (auto b : beacons) {
+                float distance = system_distance(b->system, sys) / LY_TO_M;
+
+                if (b->system == sys || distance > b->jump_range * 1.0001) continue;
+
+                relax(b, radius + get_jump_bound(distance * (1 - parameters->jump_range_reduction)) + sys_penalty[sys->seq_id]);
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (!done[i]) (*h)[i] = exhausted ? INFINITY : radius;
+    }
+}
+
+/*
+ * Finds up to k routes between the origin and destination with the penalty
+ * method: every system a route goes through costs more to enter in the
+ * searches after it, until they find enough routes through different
+ * systems. Routes more than a given factor longer than the shortest are not
+ * worth taking. The penalties are kept apart from the travel time like the
+ * security penalty, and only ever raise costs, so a single reverse search
+ * for the lowest cost to the destination serves as the heuristic of an A*
+ * search for every route, which then settles little more than the route.
+ * Jumps are only bounded loosely by that search, so for ships with a jump
+ * drive the shortest route is found without it, as get_route would.
+ */
+std::vector<Route *> Dijkstra::get_alternative_routes(int k) {
+    std::vector<Route *> routes;
+    std::vector<std::vector<int>> seen;
+    std::vector<float> h, detours(this->universe.system_count, 0);
+    bool guided = isnan(parameters->jump_range);
+    float limit = INFINITY, detour = 0;
+    Route *route = NULL;
+
+    if (!dst || k <= 0) return routes;
+
+    if (guided) {
+        solve_reverse(&h, ALTERNATIVE_STRETCH);
+        heuristic = h.data();
+
+        queue->clear();
+        initialise();
+    }
+
+    if ((route = get_route(dst)) != NULL && !guided) {
+        solve_reverse(&h, ALTERNATIVE_STRETCH);
+        heuristic = h.data();
+    }
+
+    for (int i = 1; route; i++) {
+        std::vector<int> systems;
+
+        for (auto const& w : route->points) {
+            if (systems.empty() || systems.back() != w.entity->system->seq_id) systems.push_back(w.entity->system->seq_id);
+        }
+
+        if (i == 1) {
+            limit = route->cost * ALTERNATIVE_STRETCH;
+            detour = route->cost * ALTERNATIVE_DETOUR / systems.size();
+        }
+
+        for (int s : systems) {
+            if (s != src->system->seq_id && s != dst->system->seq_id) detours[s] += detour;
+        }
+
+        if (route->cost <= limit && std::find(seen.begin(), seen.end(), systems) == seen.end()) {
+            seen.push_back(systems);
+            routes.push_back(route);
+        } else {
+            delete route;
+        }
+
+        if ((int) routes.size() == k || i == k * ALTERNATIVE_ATTEMPTS) break;
+
+        queue->clear();
+        compile_constraints();
+
+        for (int s = 0; s < this->universe.system_count; s++) {
+            sys_penalty[s] += detours[s];
+        }
+
+        loops = edges = 0;
+        initialise();
+        route = get_route(dst);
+    }
+
+    heuristic = NULL;
+
+    /*
+     * Costs with fatigue depend on the route taken, so a later search can
+     * turn up a slightly shorter route than the first.
+     */
+    std::stable_sort(routes.begin(), routes.end(), [](Route *a, Route *b) {
+        return a->cost < b->cost;
+    });
+
+    return routes;
+}
+
+/*
+ * Searches only as far as the given cost, and finds the lowest travel time to
+ * any entity of every system within it, by sequence id, and optionally the
+ * entity it belongs to. The search arrays are dense, so a single pass over
+ * them does this without building a map of every entity. The budget bounds
+ * the search cost, which includes any security penalty, while the reported
+ * times do not. With a penalty set, a system whose travel time is within
+ * the budget is therefore left out if its penalty takes the cost over it.
+ */
+void Dijkstra::get_system_distances(float max_cost, std::vector<float> *times, std::vector<Celestial *> *entities) {
+    if (dst != NULL) throw 10;
+
+    budget = max_cost;
+    solve_internal();
+
+    times->assign(universe.system_count, INFINITY);
+    if (entities) entities->assign(universe.system_count, NULL);
+
+    for (int i = 0; i < workspace->entities; i++) {
+        if (universe.entities[i].system == NULL) continue;
+
+        int s = universe.entities[i].system->seq_id;
+
+        if (cost[i] <= budget && cost[i] - penalty[i] < (*times)[s]) {
+            (*times)[s] = cost[i] - penalty[i];
+            if (entities) (*entities)[s] = &universe.entities[i];
+        }
+    }
+}
+
+void Dijkstra::solve() {
+    solve_internal();
+}
+
+/*
+ * Picks the solver compiled for the movement and fatigue model of the ship,
+ * once per search, or the generic one if specialisation is turned off or
+ * the ship neither gates nor jumps.
+ */
 void Dijkstra::solve_internal() {
+    int movement = SOLVE_ANY;
+
+    if (parameters->specialise) {
+        if (!isnan(parameters->gate_cost)) {
+            movement = isnan(parameters->jump_range) ? SOLVE_GATES : SOLVE_MIXED;
+        } else if (!isnan(parameters->jump_range)) {
+            movement = SOLVE_JUMPS;
+        }
+    }
+
+    switch (movement) {
+        case SOLVE_GATES: solve_fatigue<SOLVE_GATES>(); break;
+        case SOLVE_JUMPS: solve_fatigue<SOLVE_JUMPS>(); break;
+        case SOLVE_MIXED: solve_fatigue<SOLVE_MIXED>(); break;
+        default: solve_as<SOLVE_ANY, ANY_FATIGUE>(); break;
+    }
+}
+
+template <int M>
+void Dijkstra::solve_fatigue() {
+    switch (parameters->fatigue_model) {
+        case FATIGUE_IGNORE: solve_as<M, FATIGUE_IGNORE>(); break;
+        case FATIGUE_REACTIVATION_COST: solve_as<M, FATIGUE_REACTIVATION_COST>(); break;
+        case FATIGUE_FATIGUE_COST: solve_as<M, FATIGUE_FATIGUE_COST>(); break;
+        case FATIGUE_REACTIVATION_COUNTDOWN: solve_as<M, FATIGUE_REACTIVATION_COUNTDOWN>(); break;
+        case FATIGUE_FATIGUE_COUNTDOWN: solve_as<M, FATIGUE_FATIGUE_COUNTDOWN>(); break;
+        default: solve_as<M, FATIGUE_FULL>(); break;
+    }
+}
+
+template <int M, int F>
+void Dijkstra::solve_as() {
     int tmp = -1;
     Celestial *ent;
 
-    #pragma omp parallel num_threads(1)
-    while (!queue->is_empty() && (!dst || !vist[dst->seq_id]) && (tmp == -1 || !isinf(cost[tmp]))) {
-        #pragma omp master
-        {
-            tmp = queue->extract();
-            ent = &this->universe.entities[tmp];
-            vist[tmp] = 1;
+    while (!queue->is_empty() && (!dst || !vist[dst->seq_id]) && (tmp == -1 || (!isinf(cost[tmp]) && cost[tmp] <= budget))) {
+        tmp = queue->extract();
+        STAT_ADD(heap_extracts, 1);
+        ent = &this->universe.entities[tmp];
+        vist[tmp] = 1;
+
+        solve_w_set<M, F>(ent);
+        solve_g_set<M, F>(ent);
+        solve_r_set<M, F>(ent);
+        solve_j_set<M, F>(ent);
+
+        loops++;
+        STAT_ADD(settled, 1);
+    }
+}
+
+/*
+ * Repairs the search tree left in the workspace after the given changes to
+ * the universe, instead of searching again. Everything reached over a
+ * connection which was removed, or through an entity which is no longer
+ * relevant, is reset. The settled neighbours of what was reset, and of the
+ * ends of new connections, are then queued again with their old costs, and
+ * the search carries on from there, lowering costs wherever it finds a
+ * shorter path. This relies on the cost of a connection not depending on the
+ * path taken to it, so it does not work for the fatigue countdown models or
+ * for ships with a jump drive.
+ */
+void Dijkstra::repair(std::vector<struct graph_change> &changes) {
+    int n = this->workspace->entities;
+    std::vector<char> state(n, 0), seeded(this->universe.system_count, 0);
+    std::vector<int> roots, ends, chain;
+    bool reset = false;
+    Celestial *ent;
+    System *sys;
+
+    for (auto const& c : changes) {
+        if (c.type == CHANGE_SYSTEM) {
+            sys = this->universe.get_system_by_seq_id(c.src);
 
-            solve_w_set(ent);
-            solve_g_set(ent);
-            solve_r_set(ent);
+            for (int i = 0; i < sys->entity_count; i++) {
+                roots.push_back(sys->entities[i].seq_id);
+            }
 
-            loops++;
+            continue;
         }
 
-        #pragma omp barrier
+        ends.push_back(c.src);
+        if (c.dst != -1) ends.push_back(c.dst);
+
+        if (c.added) continue;
 
-        solve_j_set(ent);
+        if (c.type == CHANGE_DYNAMIC_BRIDGE) {
+            roots.push_back(c.src);
+        } else {
+            enum movement_type t = c.type == CHANGE_STATIC_BRIDGE ? JUMP : GATE;
 
-        #pragma omp barrier
+            if (prev[c.dst] == c.src && type[c.dst] == t) roots.push_back(c.dst);
+            if (c.type != CHANGE_STARGATE && prev[c.src] == c.dst && type[c.src] == t) roots.push_back(c.src);
+        }
     }
+
+    for (int i : ends) {
+        if (vist[i] && !celestial_is_relevant(this->universe.entities[i])) roots.push_back(i);
+    }
+
+    /*
+     * An entity is reset if any entity on its path back to the origin is one
+     * of the roots. Every path is only walked once.
+     */
+    for (int i : roots) {
+        state[i] = 1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int j = i;
+
+        while (j >= 0 && state[j] == 0 && isfinite(cost[j])) {
+            chain.push_back(j);
+            j = prev[j];
+        }
+
+        char s = j >= 0 && state[j] == 1 ? 1 : 2;
+
+        for (int k : chain) {
+            state[k] = s;
+        }
+
+        chain.clear();
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (state[i] != 1) continue;
+
+        vist[i] = 0;
+        prev[i] = -1;
+        type[i] = STRT;
+        cost[i] = INFINITY;
+
+        penalty[i] = 0.0;
+        fatigue[i] = 0.0;
+        reactivation[i] = 0.0;
+        wait[i] = 0.0;
+        distance[i] = NAN;
+
+        ends.push_back(i);
+        reset = true;
+    }
+
+    /*
+     * Whatever can reach the ends and the reset entities is queued again with
+     * its old cost: the entities in the same systems, whatever has a stargate
+     * or bridge to them, and every beacon, as those reach too far to find.
+     */
+    auto requeue = [&](Celestial *c) {
+        int i = c->seq_id;
+
+        if (state[i] == 1 || !isfinite(cost[i]) || !celestial_is_relevant(*c) || queue->contains(i)) return;
+
+        queue->insert(cost[i], i);
+    };
+
+    for (int i : ends) {
+        sys = this->universe.entities[i].system;
+
+        if (!seeded[sys->seq_id]) {
+            seeded[sys->seq_id] = 1;
+
+            for (int j = 0; j < sys->entity_count; j++) {
+                requeue(&sys->entities[j]);
+            }
+        }
+    }
+
+    for (int i = 0; reset && i < n; i++) {
+        ent = &this->universe.entities[i];
+
+        if (ent->system == NULL) continue;
+
+        if (!isnan(ent->jump_range) || (ent->destination && state[ent->destination->seq_id] == 1) || (ent->bridge && state[ent->bridge->seq_id] == 1)) {
+            requeue(ent);
+        }
+    }
+
+    repairing = true;
+    solve_internal();
+    repairing = false;
 }
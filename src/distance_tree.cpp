@@ -0,0 +1,109 @@
+#include <vector>
+#include <math.h>
+
+#include "distance_tree.hpp"
+#include "dijkstra.hpp"
+
+DistanceTree::DistanceTree(Universe &u, Celestial &src, Parameters *parameters) : universe(u), parameters(*parameters) {
+    this->src = &src;
+    this->src_id = src.id;
+
+    solve();
+}
+
+DistanceTree::DistanceTree(Universe &u, int src, Parameters *parameters) : universe(u), parameters(*parameters) {
+    if ((this->src = u.get_entity_or_default(src)) == NULL) {
+        throw 31;
+    }
+
+    this->src_id = this->src->id;
+
+    solve();
+}
+
+DistanceTree::~DistanceTree() {
+    delete workspace;
+}
+
+/*
+ * Searches from scratch, in a workspace which belongs to the tree. Sorting
+ * the universe moves the entities, so the origin is looked up again.
+ */
+void DistanceTree::solve() {
+    Celestial *e;
+
+    if (workspace == NULL || !workspace->fits(universe)) {
+        delete workspace;
+        workspace = new Workspace(universe);
+    }
+
+    if ((e = universe.get_entity(src_id)) != NULL) src = e;
+
+    Dijkstra d(universe, src, &parameters, workspace);
+    d.initialise();
+    d.solve();
+
+    generation = universe.generation;
+}
+
+bool DistanceTree::is_repairable() {
+    return isnan(parameters.jump_range) &&
+           parameters.fatigue_model != FATIGUE_REACTIVATION_COUNTDOWN &&
+           parameters.fatigue_model != FATIGUE_FATIGUE_COUNTDOWN;
+}
+
+/*
+ * Brings the tree up to date with the universe. Returns true if it could be
+ * repaired, and false if it had to search again.
+ */
+bool DistanceTree::update() {
+    std::vector<struct graph_change> changes;
+
+    if (generation == universe.generation) return true;
+
+    if (!is_repairable() || !workspace->fits(universe) || !universe.get_changes(generation, &changes)) {
+        solve();
+        return false;
+    }
+
+    Dijkstra d(universe, src, &parameters, workspace);
+    d.repair(changes);
+
+    generation = universe.generation;
+    return true;
+}
+
+float DistanceTree::get_distance(int id) {
+    Celestial *e = universe.get_entity_or_default(id);
+    return e ? get_distance(*e) : NAN;
+}
+
+float DistanceTree::get_distance(Celestial &dst) {
+    update();
+
+    if (!dst.is_relevant()) Dijkstra(universe, src, &parameters, workspace).reach(&dst);
+
+    return workspace->cost[dst.seq_id] - workspace->penalty[dst.seq_id];
+}
+
+Route *DistanceTree::get_route(int id) {
+    Celestial *e = universe.get_entity_or_default(id);
+    return e ? get_route(*e) : NULL;
+}
+
+Route *DistanceTree::get_route(Celestial &dst) {
+    update();
+
+    Dijkstra d(universe, src, &parameters, workspace);
+
+    if (!dst.is_relevant()) d.reach(&dst);
+    if (isinf(workspace->cost[dst.seq_id])) return NULL;
+
+    return d.get_path(&dst);
+}
+
+std::map<Celestial *, float> *DistanceTree::get_all_distances() {
+    update();
+
+    return Dijkstra(universe, src, &parameters, workspace).get_all_distances();
+}
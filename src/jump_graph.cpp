@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+#include "jump_graph.hpp"
+#include "kernels.hpp"
+
+JumpGraph::JumpGraph(Universe &u, float range, PrecomputeStore *store) {
+    this->range = range;
+    this->generation = u.generation;
+
+    if (store && load(u, store)) return;
+
+    build(u);
+
+    if (store) save(u, store);
+}
+
+/*
+ * Stored graphs are the number of systems and edges, followed by the three
+ * arrays.
+ */
+bool JumpGraph::load(Universe &u, PrecomputeStore *store) {
+    unsigned long size;
+    const int *data = (const int *) store->load("jump_graph", fnv1a(&range, sizeof(range)), &size);
+
+    if (data == NULL || size < 2 * sizeof(int) || data[0] != u.system_count ||
+        size != (3 + u.system_count + 2 * (unsigned long) data[1]) * sizeof(int)) {
+        return false;
+    }
+
+    offsets = data + 2;
+    targets = offsets + u.system_count + 1;
+    distances = (const float *) (targets + data[1]);
+
+    return true;
+}
+
+void JumpGraph::save(Universe &u, PrecomputeStore *store) {
+    std::vector<int> data = { u.system_count, (int) built_targets.size() };
+
+    data.insert(data.end(), built_offsets.begin(), built_offsets.end());
+    data.insert(data.end(), built_targets.begin(), built_targets.end());
+    data.resize(data.size() + built_distances.size());
+    memcpy(&data[data.size() - built_distances.size()], built_distances.data(), built_distances.size() * sizeof(float));
+
+    store->save("jump_graph", fnv1a(&range, sizeof(range)), data.data(), data.size() * sizeof(int));
+}
+
+void JumpGraph::build(Universe &u) {
+    std::vector<float> xs(u.system_count), ys(u.system_count), zs(u.system_count);
+    float range_sq = pow(range * LY_TO_M, 2.0), slab = range * LY_TO_M * 1.0001;
+    int sorted = u.sorted_systems;
+
+    for (int i = 0; i < u.system_count; i++) {
+        xs[i] = u.systems[i].x;
+        ys[i] = u.systems[i].y;
+        zs[i] = u.systems[i].z;
+    }
+
+    built_offsets.push_back(0);
+
+    for (int i = 0; i < u.system_count; i++) {
+        System *sys = &u.systems[i];
+
+        /*
+         * The same scan as Dijkstra::solve_j_set, with the same slab and
+         * chunks, so that the distances come out exactly the same.
+         */
+        int lo = std::lower_bound(xs.begin(), xs.begin() + sorted, sys->x - slab) - xs.begin();
+        int hi = std::upper_bound(xs.begin(), xs.begin() + sorted, sys->x + slab) - xs.begin();
+        int ranges[2][2] = { { lo & ~15, hi }, { sorted, u.system_count } };
+
+        for (auto const& r : ranges) {
+            for (int k = r[0]; k < r[1]; k += JUMP_CHUNK) {
+                int candidates[JUMP_CHUNK], count;
+                float distance_sq[JUMP_CHUNK];
+
+                count = get_jump_candidates(
+                    &xs[k], &ys[k], &zs[k], std::min(JUMP_CHUNK, r[1] - k),
+                    sys->x, sys->y, sys->z, range_sq, candidates, distance_sq
+                );
+
+                for (int j = 0; j < count; j++) {
+                    System *jsys = &u.systems[k + candidates[j]];
+
+                    if (jsys == sys || jsys->security >= 0.5) continue;
+
+                    built_targets.push_back(jsys->seq_id);
+                    built_distances.push_back(sqrt(distance_sq[j]) / LY_TO_M);
+                }
+            }
+        }
+
+        built_offsets.push_back(built_targets.size());
+    }
+
+    offsets = built_offsets.data();
+    targets = built_targets.data();
+    distances = built_distances.data();
+}
@@ -0,0 +1,238 @@
+#include <math.h>
+#include <string.h>
+
+#include "kernels.hpp"
+#include "dijkstra.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNEL_X86
+#endif
+
+template <int W> class Vector {
+public:
+    typedef float f __attribute__((vector_size(4 * W)));
+    typedef int i __attribute__((vector_size(4 * W)));
+};
+
+/*
+ * The kernels below are written with GCC vector extensions only, so that the
+ * same template can be inlined into wrappers compiled for different
+ * instruction sets. This is also why the square root is computed with a
+ * bit-level estimate and three Newton-Raphson steps rather than an intrinsic.
+ */
+template <int W> inline int __attribute__((always_inline)) get_jump_candidates_kernel(const float *xs, const float *ys, const float *zs, int n, float x, float y, float z, float range_sq, int *candidates, float *distance_sq) {
+    typedef typename Vector<W>::f vector_type;
+
+    vector_type x_vec, y_vec, z_vec;
+    int count = 0, k;
+
+    for (k = 0; k + W <= n; k += W) {
+        memcpy(&x_vec, xs + k, sizeof(vector_type));
+        memcpy(&y_vec, ys + k, sizeof(vector_type));
+        memcpy(&z_vec, zs + k, sizeof(vector_type));
+
+        x_vec -= x;
+        y_vec -= y;
+        z_vec -= z;
+
+        x_vec = (x_vec * x_vec) + (y_vec * y_vec) + (z_vec * z_vec);
+
+        for (int i = 0; i < W; i++) {
+            if (x_vec[i] > range_sq) continue;
+
+            candidates[count] = k + i;
+            distance_sq[count++] = x_vec[i];
+        }
+    }
+
+    for (; k < n; k++) {
+        float dx = xs[k] - x;
+        float dy = ys[k] - y;
+        float dz = zs[k] - z;
+        float d = (dx * dx) + (dy * dy) + (dz * dz);
+
+        if (d > range_sq) continue;
+
+        candidates[count] = k;
+        distance_sq[count++] = d;
+    }
+
+    return count;
+}
+
+/*
+ * The warp time is t = cruise + log(v / k_a) / k_a + log(v / 100) / k_d,
+ * where v is the maximum velocity reached during the warp. Only log(v)
+ * depends on the distance, so the rest is folded into constants and the
+ * logarithm is evaluated with the Cephes logf polynomial on the mantissa.
+ */
+template <int W> inline void __attribute__((always_inline)) get_time_kernel(float v_wrp, float x, float y, float z, const float *xs, const float *ys, const float *zs, float *time, int n) {
+    typedef typename Vector<W>::f vector_type;
+    typedef typename Vector<W>::i mask_type;
+
+    vector_type dx, dy, dz, d, r, v, m, p, u, e;
+    mask_type bits, exponent, mask;
+
+    float bx[W], by[W], bz[W], bt[W];
+
+    float k_accel = v_wrp;
+    float k_decel = (v_wrp / 3) < 2 ? (v_wrp / 3) : 2;
+
+    float v_max_wrp = v_wrp * AU_TO_M;
+    float d_min = AU_TO_M + v_max_wrp / k_decel;
+
+    float k_short = k_accel * k_decel / (k_accel + k_decel);
+    float k_log = 1 / k_accel + 1 / k_decel;
+    float c_log = -log(k_accel) / k_accel - log(100) / k_decel;
+
+    for (int k = 0; k < n; k += W) {
+        if (k + W <= n) {
+            memcpy(&dx, xs + k, sizeof(vector_type));
+            memcpy(&dy, ys + k, sizeof(vector_type));
+            memcpy(&dz, zs + k, sizeof(vector_type));
+        } else {
+            for (int i = 0; i < W; i++) {
+                bx[i] = k + i < n ? xs[k + i] : x + AU_TO_M;
+                by[i] = k + i < n ? ys[k + i] : y;
+                bz[i] = k + i < n ? zs[k + i] : z;
+            }
+
+            memcpy(&dx, bx, sizeof(vector_type));
+            memcpy(&dy, by, sizeof(vector_type));
+            memcpy(&dz, bz, sizeof(vector_type));
+        }
+
+        dx -= x;
+        dy -= y;
+        dz -= z;
+
+        d = dx * dx + dy * dy + dz * dz;
+        r = (vector_type) (0x5f375a86 - ((mask_type) d >> 1));
+        r = r * (1.5f - 0.5f * d * r * r);
+        r = r * (1.5f - 0.5f * d * r * r);
+        r = r * (1.5f - 0.5f * d * r * r);
+        d = d * r;
+
+        mask = d < d_min;
+        v = (vector_type) (((mask_type) (d * k_short) & mask) | ((mask_type) (d * 0.0f + v_max_wrp) & ~mask));
+        u = (vector_type) ((mask_type) ((d - d_min) / v_max_wrp) & ~mask);
+
+        bits = (mask_type) v;
+        exponent = ((bits >> 23) & 0xff) - 126;
+        m = (vector_type) ((bits & 0x807fffff) | 0x3f000000);
+
+        mask = m < 0.707106781186547524f;
+        exponent += mask;
+        m = m - 1.0f + (vector_type) ((mask_type) m & mask);
+        e = __builtin_convertvector(exponent, vector_type);
+
+        p = m * 7.0376836292E-2f - 1.1514610310E-1f;
+        p = p * m + 1.1676998740E-1f;
+        p = p * m - 1.2420140846E-1f;
+        p = p * m + 1.4249322787E-1f;
+        p = p * m - 1.6668057665E-1f;
+        p = p * m + 2.0000714765E-1f;
+        p = p * m - 2.4999993993E-1f;
+        p = p * m + 3.3333331174E-1f;
+        p = p * m * (m * m) - 2.12194440E-4f * e - 0.5f * (m * m);
+
+        v = u + (m + p + 0.693359375f * e) * k_log + c_log;
+
+        if (k + W <= n) {
+            memcpy(time + k, &v, sizeof(vector_type));
+        } else {
+            memcpy(bt, &v, sizeof(vector_type));
+
+            for (int i = 0; k + i < n; i++) {
+                time[k + i] = bt[i];
+            }
+        }
+    }
+}
+
+static int get_jump_candidates_scalar(const float *xs, const float *ys, const float *zs, int n, float x, float y, float z, float range_sq, int *candidates, float *distance_sq) {
+    int count = 0;
+
+    for (int k = 0; k < n; k++) {
+        float dx = xs[k] - x;
+        float dy = ys[k] - y;
+        float dz = zs[k] - z;
+        float d = (dx * dx) + (dy * dy) + (dz * dz);
+
+        if (d > range_sq) continue;
+
+        candidates[count] = k;
+        distance_sq[count++] = d;
+    }
+
+    return count;
+}
+
+static void get_time_batch_scalar(float v_wrp, float x, float y, float z, const float *xs, const float *ys, const float *zs, float *time, int n) {
+    for (int k = 0; k < n; k++) {
+        float dx = xs[k] - x;
+        float dy = ys[k] - y;
+        float dz = zs[k] - z;
+
+        time[k] = Dijkstra::get_time(v_wrp, sqrt(dx * dx + dy * dy + dz * dz));
+    }
+}
+
+#ifdef KERNEL_X86
+#define KERNEL_VARIANT(isa, width) \
+    static __attribute__((target(#isa))) int get_jump_candidates_##isa(const float *xs, const float *ys, const float *zs, int n, float x, float y, float z, float range_sq, int *candidates, float *distance_sq) { \
+        return get_jump_candidates_kernel<width>(xs, ys, zs, n, x, y, z, range_sq, candidates, distance_sq); \
+    } \
+    static __attribute__((target(#isa))) void get_time_batch_##isa(float v_wrp, float x, float y, float z, const float *xs, const float *ys, const float *zs, float *time, int n) { \
+        get_time_kernel<width>(v_wrp, x, y, z, xs, ys, zs, time, n); \
+    }
+
+KERNEL_VARIANT(sse2, 4)
+KERNEL_VARIANT(avx2, 8)
+KERNEL_VARIANT(avx512f, 16)
+#endif
+
+const struct kernel_set kernel_sets[] = {
+    { "scalar", 1, get_jump_candidates_scalar, get_time_batch_scalar },
+    #ifdef KERNEL_X86
+    { "sse2", 4, get_jump_candidates_sse2, get_time_batch_sse2 },
+    { "avx2", 8, get_jump_candidates_avx2, get_time_batch_avx2 },
+    { "avx512", 16, get_jump_candidates_avx512f, get_time_batch_avx512f },
+    #endif
+};
+
+const int kernel_set_count = sizeof(kernel_sets) / sizeof(kernel_sets[0]);
+
+bool kernel_set_is_supported(const struct kernel_set *k) {
+    #ifdef KERNEL_X86
+    __builtin_cpu_init();
+
+    if (strcmp(k->name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(k->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(k->name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+    #endif
+
+    return strcmp(k->name, "scalar") == 0;
+}
+
+static const struct kernel_set *select_kernel_set() {
+    for (int i = kernel_set_count - 1; i > 0; i--) {
+        if (kernel_set_is_supported(&kernel_sets[i])) return &kernel_sets[i];
+    }
+
+    return &kernel_sets[0];
+}
+
+static const struct kernel_set *active_kernel_set = select_kernel_set();
+
+const struct kernel_set *get_kernel_set() {
+    return active_kernel_set;
+}
+
+int get_jump_candidates(const float *xs, const float *ys, const float *zs, int n, float x, float y, float z, float range_sq, int *candidates, float *distance_sq) {
+    return active_kernel_set->get_jump_candidates(xs, ys, zs, n, x, y, z, range_sq, candidates, distance_sq);
+}
+
+void get_time_batch(float v_wrp, float x, float y, float z, const float *xs, const float *ys, const float *zs, float *time, int n) {
+    active_kernel_set->get_time_batch(v_wrp, x, y, z, xs, ys, zs, time, n);
+}
@@ -5,18 +5,28 @@
 #include <string.h>
 #include <assert.h>
 #include <argp.h>
+#include <thread>
 
 #include <readline/readline.h>
 #include <readline/history.h>
 
 #include "universe.hpp"
 #include "dijkstra.hpp"
+#include "server.hpp"
+#include "batch.hpp"
 
 int verbose = 0;
+int hierarchical = 0;
 
 struct arguments {
     char *args[2];
     char *batch;
+    char *export_path;
+    char *attach_path;
+    char *store_path;
+    char *listen;
+    int threads;
+    int unordered;
     int silent;
     int quit;
     int gen_count;
@@ -38,13 +48,26 @@ static struct argp_option options[] = {
 
     {"route", 'R', "origin:destination", 0, "Route between two entity IDs", 1},
     {"nothing", 'N', 0, 0, "Uninteractively exit without doing routing", 1},
-    {"experiment", 'E', "file", 0, "Read experiment parameters from file", 1},
+    {"batch", 'B', "file", 0, "Route the requests in a file, or - for standard input, to standard output", 1},
+    {"experiment", 'E', 0, OPTION_ALIAS },
+    {"unordered", 1000, 0, 0, "Write batch routes as soon as they are found, rather than in order", 1},
     {"generate", 'G', "count:l|r|w", 0, "Write experimental parameters to stdout", 1},
+    {"hierarchical", 'H', 0, 0, "Route over the region hierarchy where possible", 1},
+    {"export", 'X', "file", 0, "Write the universe to a file other processes can attach", 1},
+    {"attach", 'A', "file", 0, "Attach an exported universe instead of loading one", 1},
+    {"store", 'P', "directory", 0, "Keep precomputed data in a directory, shared between runs", 1},
+    {"listen", 'L', "path|[host:]port", 0, "Serve routes on a Unix domain socket or TCP port", 1},
+    {"threads", 'j', "count", 0, "Route with this many worker threads", 1},
 
     {"jump", 2000, "value", 0, "Set jump drive range in lightyears", 2},
     {"align", 2001, "value", 0, "Set align time in seconds", 2},
     {"warp", 2002, "value", 0, "Set warp speed in astronomical units per second", 2},
     {"gate", 2003, "value", 0, "Set the per-gate time in seconds (negative to disable)", 2},
+    {"min-security", 2004, "value", 0, "Never enter systems with a lower security status", 2},
+    {"max-security", 2005, "value", 0, "Never enter systems with a higher security status", 2},
+    {"avoid", 2006, "system", 0, "Never enter the given system (may be repeated)", 2},
+    {"avoid-region", 2007, "region", 0, "Never enter the given region (may be repeated)", 2},
+    {"safety", 2008, "value", 0, "Set the penalty in seconds for entering unsafe systems", 2},
 
     {"version", 3000, 0, 0, "Print the version of the program", 3},
     { 0 }
@@ -66,9 +89,13 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
         case 's':
             // arguments->silent = 1;
             break;
+        case 'B':
         case 'E':
             arguments->batch = arg;
             break;
+        case 1000:
+            arguments->unordered = 1;
+            break;
         case 'N':
             arguments->quit = 1;
             break;
@@ -78,6 +105,24 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
         case 'R':
             sscanf(arg, "%d:%d", &arguments->src, &arguments->dst);
             break;
+        case 'H':
+            hierarchical = 1;
+            break;
+        case 'X':
+            arguments->export_path = arg;
+            break;
+        case 'A':
+            arguments->attach_path = arg;
+            break;
+        case 'P':
+            arguments->store_path = arg;
+            break;
+        case 'L':
+            arguments->listen = arg;
+            break;
+        case 'j':
+            arguments->threads = atoi(arg);
+            break;
         case 2000:
             parameters.jump_range = atof(arg);
             break;
@@ -90,6 +135,21 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
         case 2003:
             parameters.gate_cost = atof(arg);
             break;
+        case 2004:
+            parameters.min_security = atof(arg);
+            break;
+        case 2005:
+            parameters.max_security = atof(arg);
+            break;
+        case 2006:
+            parameters.avoid_system(atoi(arg));
+            break;
+        case 2007:
+            parameters.avoid_region(atoi(arg));
+            break;
+        case 2008:
+            parameters.security_penalty = atof(arg);
+            break;
         case 3000:
             fprintf(stderr, "NERD-0.0.15\n");
             exit(0);
@@ -100,7 +160,7 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
             arguments->args[state->arg_num] = arg;
             break;
         case ARGP_KEY_END:
-            if (state->arg_num < 2)
+            if (state->arg_num < 2 && !arguments->attach_path)
             argp_usage(state);
             break;
         default:
@@ -112,39 +172,52 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
 
 static struct argp argp = { options, parse_opt, args_doc, NULL };
 
-void run_batch_experiment(Universe &u, FILE *f) {
-    int res;
-    int src, dst;
-    Celestial *src_e, *dst_e;
-    Route *route;
+void run_batch_file(Universe &u, const char *path, int threads, bool ordered) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    struct batch_stats stats = {};
 
-    do {
-        res = fscanf(f, "%d %d\n", &src, &dst);
+    if (f == NULL) {
+        fprintf(stderr, "Could not open the batch file\n");
+        return;
+    }
 
-        src_e = u.get_entity(src);
-        dst_e = u.get_entity(dst);
+    clock_gettime(CLOCK_MONOTONIC, &timer_start);
+    run_batch(u, f, stdout, parameters, hierarchical, threads, ordered, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &timer_end);
 
-        route = Dijkstra(u, src_e, dst_e, &parameters).get_route();
+    fprintf(stderr, "Routed %ld queries (%ld found, %ld failed) in %.3f seconds, %.3f ms per query\n",
+        stats.count, stats.found, stats.failed, time_diff(&timer_start, &timer_end) / 1E9,
+        stats.count ? time_diff(&timer_start, &timer_end) / 1E6 / stats.count : 0.0
+    );
 
-        free(route);
-    } while (res != EOF);
+    if (f != stdin) fclose(f);
 }
 
+void run_route(Universe &u, int src_id, int dst_id, Parameters *param);
+
 void run_user_interface(Universe &universe) {
-    char *pch, *input, *param, *value;
+    char *pch, *input, *param, *value, *s, *d;
 
-    while (1) {
-        input = readline("NERD> ");
+    while ((input = readline("NERD> ")) != NULL) {
         add_history(input);
 
-        pch = strtok(input, " ");
+        if ((pch = strtok(input, " ")) == NULL) {
+            free(input);
+            continue;
+        }
 
         if (strcmp(pch, "quit") == 0) {
+            free(input);
             break;
         } else if (strcmp(pch, "route") == 0) {
-            int s = atoi(strtok(NULL, " "));
-            int d = atoi(strtok(NULL, " "));
-            universe.get_route(s, d, &parameters);
+            s = strtok(NULL, " ");
+            d = strtok(NULL, " ");
+
+            if (s && d) {
+                run_route(universe, atoi(s), atoi(d), &parameters);
+            } else {
+                fprintf(stderr, "Usage: route origin destination\n");
+            }
         } else if (strcmp(pch, "parameters") == 0) {
             fprintf(stderr, "Jump drive: %.1f LY\n", parameters.jump_range);
             fprintf(stderr, "Warp speed: %.1f AU/s\n", parameters.warp_speed);
@@ -153,7 +226,9 @@ void run_user_interface(Universe &universe) {
             param = strtok(NULL, " ");
             value = strtok(NULL, " ");
 
-            if (strcmp(param, "warp") == 0) {
+            if (param == NULL || value == NULL) {
+                fprintf(stderr, "Usage: set warp|jump|align value\n");
+            } else if (strcmp(param, "warp") == 0) {
                 parameters.warp_speed = atof(value);
             } else if (strcmp(param, "jump") == 0) {
                 parameters.jump_range = atof(value);
@@ -161,9 +236,20 @@ void run_user_interface(Universe &universe) {
                 parameters.align_time = atof(value);
             }
         }
+
+        free(input);
     }
 }
 
+void run_server(Universe &u, const char *address, int threads) {
+    Server server(u, parameters, hierarchical, threads);
+
+    if (!server.listen(address)) return;
+
+    fprintf(stderr, "Listening on %s with %d workers...\n", address, threads);
+    server.run();
+}
+
 void run_generate_batch(Universe &u, char type, int count) {
     System *src_s, *dst_s;
     Celestial *src_e, *dst_e;
@@ -192,9 +278,19 @@ void run_route(Universe &u, int src_id, int dst_id, Parameters *param) {
     Celestial *src = u.get_entity_or_default(src_id);
     Celestial *dst = u.get_entity_or_default(dst_id);
 
+    if (src == NULL || dst == NULL) {
+        fprintf(stderr, "Unknown origin or destination\n");
+        return;
+    }
+
     std::cout << "Routing from " << src->name << " to " << dst->name << "...\n";
 
-    Route *route = Dijkstra(u, src, dst, param).get_route();
+    Route *route = hierarchical ? u.get_hierarchical_route(*src, *dst, param) : Dijkstra(u, src, dst, param).get_route();
+
+    if (route == NULL) {
+        fprintf(stderr, "No route found\n");
+        return;
+    }
 
     fprintf(stderr, "Travel time: %u minutes, %02u seconds (%lu steps)\n", ((int) route->cost) / 60, ((int) route->cost) % 60, route->points.size());
     fprintf(stderr, "Route: \n");
@@ -203,6 +299,16 @@ void run_route(Universe &u, int src_id, int dst_id, Parameters *param) {
         std::cout << "    " << movement_type_str[i->type] << ": " << i->entity->name << "\n";
     }
 
+    #ifdef NERD_STATS
+    if (verbose >= 2) {
+        struct search_stats *s = &route->stats;
+
+        fprintf(stderr, "Settled %ld nodes, heap %ld/%ld/%ld (insert/decrease/extract)\n", s->settled, s->heap_inserts, s->heap_decreases, s->heap_extracts);
+        fprintf(stderr, "Relaxed %ld warps, %ld gates, %ld jumps; %ld of %ld jump candidates accepted\n", s->relaxed_warp, s->relaxed_gate, s->relaxed_jump, s->jump_accepted, s->jump_scanned);
+        fprintf(stderr, "Setup %.3f ms, search %.3f ms, path %.3f ms\n", s->setup_time * 1E3, s->search_time * 1E3, s->path_time * 1E3);
+    }
+    #endif
+
     delete route;
 }
 
@@ -218,6 +324,12 @@ int main(int argc, char **argv) {
     struct arguments arguments;
 
     arguments.batch = NULL;
+    arguments.export_path = NULL;
+    arguments.attach_path = NULL;
+    arguments.store_path = NULL;
+    arguments.listen = NULL;
+    arguments.unordered = 0;
+    arguments.threads = std::max(1u, std::thread::hardware_concurrency());
     arguments.src = 0;
     arguments.dst = 0;
     arguments.gen_type = 0;
@@ -229,22 +341,36 @@ int main(int argc, char **argv) {
     }
 
     clock_gettime(CLOCK_MONOTONIC, &timer_start);
-    Universe universe(arguments.args[0], arguments.args[1]);
+    Universe *u = arguments.attach_path ? Universe::attach_shared(arguments.attach_path) : new Universe(arguments.args[0], arguments.args[1]);
+    Universe &universe = *u;
     clock_gettime(CLOCK_MONOTONIC, &timer_end);
 
     fprintf(stderr, "Loaded New Eden (%d systems, %d entities) in %.3f seconds...\n",
         universe.system_count, universe.entity_count, time_diff(&timer_start, &timer_end) / 1E9
     );
 
+    if (arguments.export_path != NULL) {
+        universe.export_shared(arguments.export_path);
+        fprintf(stderr, "Exported the universe to %s\n", arguments.export_path);
+    }
+
+    if (arguments.store_path != NULL) {
+        universe.open_store(arguments.store_path);
+    }
+
     if (arguments.src != 0 && arguments.dst != 0) {
         run_route(universe, arguments.src, arguments.dst, &parameters);
     } else if (arguments.batch != NULL) {
-        run_batch_experiment(universe, fopen(arguments.batch, "r"));
+        run_batch_file(universe, arguments.batch, arguments.threads, !arguments.unordered);
+    } else if (arguments.listen != NULL) {
+        run_server(universe, arguments.listen, arguments.threads);
     } else if (arguments.gen_type != 0) {
         run_generate_batch(universe, arguments.gen_type, arguments.gen_count);
     } else if (!arguments.quit) {
         run_user_interface(universe);
     }
 
+    delete u;
+
     return 0;
 }
@@ -0,0 +1,287 @@
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <math.h>
+
+#include "metrics.hpp"
+#include "universe.hpp"
+
+static_assert(preset_count < METRICS_SERIES, "every preset needs its own metrics series");
+
+static const double bucket_bounds[METRICS_BUCKETS] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, INFINITY
+};
+
+static const char *cache_names[CACHE_COUNT] = {
+    [CACHE_REGION_ROUTER] = "region_router",
+    [CACHE_WORKSPACE] = "workspace",
+    [CACHE_JUMP_GRAPH] = "jump_graph"
+};
+
+static std::atomic<int> next_shard(0);
+
+static bool same(float a, float b) {
+    return a == b || (isnan(a) && isnan(b));
+}
+
+Metrics::Metrics() {
+    this->shards = new struct metrics_shard[METRICS_SHARDS]();
+}
+
+Metrics::~Metrics() {
+    delete[] this->shards;
+}
+
+/*
+ * Threads are assigned shards round robin the first time they record
+ * anything, and keep them for their lifetime.
+ */
+struct metrics_shard *Metrics::get_shard() {
+    static thread_local int shard = next_shard.fetch_add(1, std::memory_order_relaxed) % METRICS_SHARDS;
+    return &this->shards[shard];
+}
+
+int Metrics::get_series(Parameters *p) {
+    for (int i = 0; i < preset_count; i++) {
+        const Parameters *q = presets[i].parameters;
+
+        if (same(p->warp_speed, q->warp_speed) && same(p->align_time, q->align_time) &&
+            same(p->gate_cost, q->gate_cost) && same(p->jump_range, q->jump_range) &&
+            same(p->jump_range_reduction, q->jump_range_reduction)) {
+            return i;
+        }
+    }
+
+    return preset_count;
+}
+
+void Metrics::start(struct timespec *start) {
+    clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+void Metrics::record_query(Parameters *p, struct timespec *start, bool found) {
+    struct metrics_series *s = &get_shard()->series[get_series(p)];
+    struct timespec end;
+    unsigned long ns;
+    int b = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = (end.tv_sec - start->tv_sec) * 1000000000 + (end.tv_nsec - start->tv_nsec);
+
+    while (ns > bucket_bounds[b] * 1E9) b++;
+
+    s->queries.fetch_add(1, std::memory_order_relaxed);
+    s->latency_ns.fetch_add(ns, std::memory_order_relaxed);
+    s->buckets[b].fetch_add(1, std::memory_order_relaxed);
+
+    if (!found) s->failures.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::record_cache(enum metrics_cache cache, bool hit) {
+    struct metrics_shard *s = get_shard();
+
+    if (hit) {
+        s->cache_hits[cache].fetch_add(1, std::memory_order_relaxed);
+    } else {
+        s->cache_misses[cache].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/*
+ * A snapshot of all shards summed together, which the dump formats share.
+ */
+struct metrics_snapshot {
+    unsigned long queries[METRICS_SERIES], failures[METRICS_SERIES], latency_ns[METRICS_SERIES];
+    unsigned long buckets[METRICS_SERIES][METRICS_BUCKETS];
+    unsigned long cache_hits[CACHE_COUNT], cache_misses[CACHE_COUNT];
+    int workspaces, workspaces_in_use;
+    std::vector<std::pair<const char *, unsigned long>> memory;
+};
+
+static void take_snapshot(struct metrics_shard *shards, Universe &u, struct metrics_snapshot *r) {
+    *r = metrics_snapshot();
+
+    for (int i = 0; i < METRICS_SHARDS; i++) {
+        for (int j = 0; j < METRICS_SERIES; j++) {
+            struct metrics_series *s = &shards[i].series[j];
+
+            r->queries[j] += s->queries.load(std::memory_order_relaxed);
+            r->failures[j] += s->failures.load(std::memory_order_relaxed);
+            r->latency_ns[j] += s->latency_ns.load(std::memory_order_relaxed);
+
+            for (int k = 0; k < METRICS_BUCKETS; k++) {
+                r->buckets[j][k] += s->buckets[k].load(std::memory_order_relaxed);
+            }
+        }
+
+        for (int j = 0; j < CACHE_COUNT; j++) {
+            r->cache_hits[j] += shards[i].cache_hits[j].load(std::memory_order_relaxed);
+            r->cache_misses[j] += shards[i].cache_misses[j].load(std::memory_order_relaxed);
+        }
+    }
+
+    r->memory.push_back(std::make_pair("systems", (unsigned long) u.system_capacity * sizeof(System)));
+    r->memory.push_back(std::make_pair("entities", (unsigned long) u.entity_capacity * sizeof(Celestial)));
+    r->memory.push_back(std::make_pair("names", u.names_size));
+    r->memory.push_back(std::make_pair("id_maps", (unsigned long) u.get_id_map_size() * 48));
+
+    /*
+     * A workspace holds 48 bytes per entity, counting the heap, and 17 bytes
+     * per system.
+     */
+    r->workspaces = u.get_workspace_count();
+    r->workspaces_in_use = u.get_workspaces_in_use();
+    r->memory.push_back(std::make_pair("workspaces", (unsigned long) r->workspaces * (48 * u.get_entity_slots() + 17 * u.system_count)));
+}
+
+static const char *series_name(int i) {
+    return i < preset_count ? presets[i].name : "custom";
+}
+
+std::string Metrics::to_prometheus(Universe &u) {
+    struct metrics_snapshot s;
+    std::string r;
+    char buffer[256];
+    unsigned long total;
+
+    take_snapshot(shards, u, &s);
+
+    r += "# HELP eve_nerd_queries_total Routing queries by ship preset.\n";
+    r += "# TYPE eve_nerd_queries_total counter\n";
+
+    for (int i = 0; i <= preset_count; i++) {
+        if (s.queries[i] == 0) continue;
+        snprintf(buffer, sizeof(buffer), "eve_nerd_queries_total{preset=\"%s\"} %lu\n", series_name(i), s.queries[i]);
+        r += buffer;
+    }
+
+    r += "# HELP eve_nerd_queries_failed_total Routing queries for which no route exists.\n";
+    r += "# TYPE eve_nerd_queries_failed_total counter\n";
+
+    for (int i = 0; i <= preset_count; i++) {
+        if (s.queries[i] == 0) continue;
+        snprintf(buffer, sizeof(buffer), "eve_nerd_queries_failed_total{preset=\"%s\"} %lu\n", series_name(i), s.failures[i]);
+        r += buffer;
+    }
+
+    r += "# HELP eve_nerd_query_duration_seconds Routing query latency.\n";
+    r += "# TYPE eve_nerd_query_duration_seconds histogram\n";
+
+    for (int i = 0; i <= preset_count; i++) {
+        if (s.queries[i] == 0) continue;
+
+        total = 0;
+
+        for (int k = 0; k < METRICS_BUCKETS; k++) {
+            total += s.buckets[i][k];
+
+            if (isinf(bucket_bounds[k])) {
+                snprintf(buffer, sizeof(buffer), "eve_nerd_query_duration_seconds_bucket{preset=\"%s\",le=\"+Inf\"} %lu\n", series_name(i), total);
+            } else {
+                snprintf(buffer, sizeof(buffer), "eve_nerd_query_duration_seconds_bucket{preset=\"%s\",le=\"%g\"} %lu\n", series_name(i), bucket_bounds[k], total);
+            }
+
+            r += buffer;
+        }
+
+        snprintf(buffer, sizeof(buffer), "eve_nerd_query_duration_seconds_sum{preset=\"%s\"} %.9f\n", series_name(i), s.latency_ns[i] / 1E9);
+        r += buffer;
+        snprintf(buffer, sizeof(buffer), "eve_nerd_query_duration_seconds_count{preset=\"%s\"} %lu\n", series_name(i), s.queries[i]);
+        r += buffer;
+    }
+
+    r += "# HELP eve_nerd_cache_hits_total Lookups of cached structures which were found and up to date.\n";
+    r += "# TYPE eve_nerd_cache_hits_total counter\n";
+
+    for (int i = 0; i < CACHE_COUNT; i++) {
+        snprintf(buffer, sizeof(buffer), "eve_nerd_cache_hits_total{cache=\"%s\"} %lu\n", cache_names[i], s.cache_hits[i]);
+        r += buffer;
+    }
+
+    r += "# HELP eve_nerd_cache_misses_total Lookups of cached structures which had to be built.\n";
+    r += "# TYPE eve_nerd_cache_misses_total counter\n";
+
+    for (int i = 0; i < CACHE_COUNT; i++) {
+        snprintf(buffer, sizeof(buffer), "eve_nerd_cache_misses_total{cache=\"%s\"} %lu\n", cache_names[i], s.cache_misses[i]);
+        r += buffer;
+    }
+
+    r += "# HELP eve_nerd_memory_bytes Approximate memory used by the universe tables.\n";
+    r += "# TYPE eve_nerd_memory_bytes gauge\n";
+
+    for (auto const& m : s.memory) {
+        snprintf(buffer, sizeof(buffer), "eve_nerd_memory_bytes{table=\"%s\"} %lu\n", m.first, m.second);
+        r += buffer;
+    }
+
+    r += "# HELP eve_nerd_workspaces Search workspaces allocated by the universe, and those in use.\n";
+    r += "# TYPE eve_nerd_workspaces gauge\n";
+
+    snprintf(buffer, sizeof(buffer), "eve_nerd_workspaces{state=\"allocated\"} %d\neve_nerd_workspaces{state=\"in_use\"} %d\n", s.workspaces, s.workspaces_in_use);
+    r += buffer;
+
+    r += "# HELP eve_nerd_universe_size Number of systems and entities in the universe.\n";
+    r += "# TYPE eve_nerd_universe_size gauge\n";
+
+    snprintf(buffer, sizeof(buffer), "eve_nerd_universe_size{kind=\"systems\"} %d\neve_nerd_universe_size{kind=\"entities\"} %d\n", u.system_count, u.entity_count);
+    r += buffer;
+
+    return r;
+}
+
+std::string Metrics::to_json(Universe &u) {
+    struct metrics_snapshot s;
+    std::string r;
+    char buffer[256];
+    bool first = true;
+
+    take_snapshot(shards, u, &s);
+
+    r += "{\"queries\": {";
+
+    for (int i = 0; i <= preset_count; i++) {
+        if (s.queries[i] == 0) continue;
+
+        snprintf(buffer, sizeof(buffer), "%s\"%s\": {\"count\": %lu, \"failed\": %lu, \"latency_seconds\": %.9f, \"buckets\": [",
+            first ? "" : ", ", series_name(i), s.queries[i], s.failures[i], s.latency_ns[i] / 1E9
+        );
+        r += buffer;
+
+        for (int k = 0; k < METRICS_BUCKETS; k++) {
+            snprintf(buffer, sizeof(buffer), "%s%lu", k ? ", " : "", s.buckets[i][k]);
+            r += buffer;
+        }
+
+        r += "]}";
+        first = false;
+    }
+
+    r += "}, \"bucket_bounds\": [";
+
+    for (int k = 0; k < METRICS_BUCKETS - 1; k++) {
+        snprintf(buffer, sizeof(buffer), "%s%g", k ? ", " : "", bucket_bounds[k]);
+        r += buffer;
+    }
+
+    r += "], \"caches\": {";
+
+    for (int i = 0; i < CACHE_COUNT; i++) {
+        snprintf(buffer, sizeof(buffer), "%s\"%s\": {\"hits\": %lu, \"misses\": %lu}", i ? ", " : "", cache_names[i], s.cache_hits[i], s.cache_misses[i]);
+        r += buffer;
+    }
+
+    snprintf(buffer, sizeof(buffer), "}, \"workspaces\": {\"allocated\": %d, \"in_use\": %d", s.workspaces, s.workspaces_in_use);
+    r += buffer;
+
+    r += "}, \"memory_bytes\": {";
+
+    for (unsigned int i = 0; i < s.memory.size(); i++) {
+        snprintf(buffer, sizeof(buffer), "%s\"%s\": %lu", i ? ", " : "", s.memory[i].first, s.memory[i].second);
+        r += buffer;
+    }
+
+    snprintf(buffer, sizeof(buffer), "}, \"systems\": %d, \"entities\": %d}", u.system_count, u.entity_count);
+    r += buffer;
+
+    return r;
+}
@@ -25,10 +25,25 @@ template <class P, class V> MinHeap<P, V>::~MinHeap() {
     delete[] this->array;
 }
 
+/*
+ * Empties the heap, so that it can be reused without allocating it again.
+ */
+template <class P, class V> void MinHeap<P, V>::clear() {
+    for (int i = 0; i < this->occupied; i++) {
+        this->map[this->array[i].value] = -1;
+    }
+
+    this->occupied = 0;
+}
+
 template <class P, class V> bool MinHeap<P, V>::is_empty() {
     return occupied == 0;
 }
 
+template <class P, class V> bool MinHeap<P, V>::contains(V value) {
+    return this->map[value] != -1;
+}
+
 template <class P, class V> void MinHeap<P, V>::swap(V ia, V ib) {
     MinHeapElement<P, V> *a, *b, tmp;
 
@@ -107,8 +122,11 @@ template <class P, class V> V MinHeap<P, V>::extract() {
     MinHeapElement<P, V> *elem, *child_left, *child_right, *child_smallest;
     V rv = this->array[0].value, index, child_index;
 
-    this->map[this->array[0].value] = -1;
-    elem = this->array + --this->occupied;
+    this->map[rv] = -1;
+
+    if (--this->occupied == 0) return rv;
+
+    elem = this->array + this->occupied;
     this->array[0].priority = elem->priority;
     this->array[0].value = elem->value;
     this->map[this->array[0].value] = 0;
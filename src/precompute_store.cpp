@@ -0,0 +1,115 @@
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "precompute_store.hpp"
+#include "parameters.hpp"
+
+#define STORE_MAGIC "NERDPRE"
+#define STORE_VERSION 1
+
+struct store_header {
+    char magic[8];
+    int version, reserved;
+    uint64_t checksum, key, hash;
+    unsigned long size;
+    char padding[16];
+};
+
+static_assert(sizeof(struct store_header) == 64, "the payload is aligned to 64 bytes");
+
+/*
+ * Creates the directory if it does not exist yet. Throws if it can not.
+ */
+PrecomputeStore::PrecomputeStore(std::string directory, uint64_t checksum) {
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw 41;
+    }
+
+    this->directory = directory;
+    this->checksum = checksum;
+}
+
+PrecomputeStore::~PrecomputeStore() {
+    for (auto const& m : mappings) {
+        munmap(m.first, m.second);
+    }
+}
+
+std::string PrecomputeStore::get_path(const char *kind, uint64_t key) {
+    char name[128];
+
+    snprintf(name, sizeof(name), "/%s-%016llx-%016llx.bin", kind, (unsigned long long) checksum, (unsigned long long) key);
+
+    return directory + name;
+}
+
+/*
+ * Maps an entry and returns its contents and their size, or NULL if there is
+ * no valid entry.
+ */
+const void *PrecomputeStore::load(const char *kind, uint64_t key, unsigned long *size) {
+    std::string path = get_path(kind, key);
+    struct store_header h;
+    struct stat st;
+    void *base;
+    int fd;
+
+    if ((fd = open(path.c_str(), O_RDONLY)) < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || (unsigned long) st.st_size < sizeof(h) || (base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    close(fd);
+    memcpy(&h, base, sizeof(h));
+
+    if (memcmp(h.magic, STORE_MAGIC, sizeof(h.magic)) != 0 || h.version != STORE_VERSION ||
+        h.checksum != checksum || h.key != key || h.size != st.st_size - sizeof(h) ||
+        fnv1a((char *) base + sizeof(h), h.size) != h.hash) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        mappings.push_back(std::make_pair(base, (unsigned long) st.st_size));
+    }
+
+    *size = h.size;
+
+    return (char *) base + sizeof(h);
+}
+
+/*
+ * Writes an entry, to a temporary file first so that other processes never
+ * see half of it. Failing to write is not an error, the data is computed
+ * again next time.
+ */
+void PrecomputeStore::save(const char *kind, uint64_t key, const void *data, unsigned long size) {
+    std::string path = get_path(kind, key), tmp = path + "." + std::to_string(getpid()) + ".tmp";
+    struct store_header h = {};
+    FILE *f;
+
+    memcpy(h.magic, STORE_MAGIC, sizeof(h.magic));
+    h.version = STORE_VERSION;
+    h.checksum = checksum;
+    h.key = key;
+    h.hash = fnv1a(data, size);
+    h.size = size;
+
+    if ((f = fopen(tmp.c_str(), "wb")) == NULL) return;
+
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && (size == 0 || fwrite(data, size, 1, f) == 1);
+
+    if (fclose(f) != 0 || !ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+    }
+}
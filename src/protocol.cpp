@@ -0,0 +1,398 @@
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "protocol.hpp"
+
+/*
+ * The values the protocol knows about: numbers, strings, booleans, null and
+ * arrays of numbers. The start and end of the value in the line are kept so
+ * that the id can be echoed back exactly as it was sent.
+ */
+struct json_value {
+    enum { NONE, NUMBER, STRING, BOOLEAN, NUMBERS } type;
+    double number;
+    bool boolean;
+    std::string string;
+    std::vector<int> numbers;
+    const char *start, *end;
+};
+
+static void skip_space(const char **p) {
+    while (isspace((unsigned char) **p)) (*p)++;
+}
+
+static bool read_literal(const char **p, const char *literal) {
+    if (strncmp(*p, literal, strlen(literal)) != 0) return false;
+
+    *p += strlen(literal);
+    return true;
+}
+
+static bool read_number(const char **p, double *out) {
+    char *end;
+
+    *out = strtod(*p, &end);
+
+    if (end == *p || !isfinite(*out)) return false;
+
+    *p = end;
+    return true;
+}
+
+/*
+ * Reads a JSON string. Escaped characters beyond ASCII are replaced, as none
+ * of the fields need them.
+ */
+static bool read_string(const char **p, std::string *out) {
+    const char *s = *p;
+    char hex[5] = {};
+
+    if (*s != '"') return false;
+
+    out->clear();
+
+    for (s++; *s != '"'; s++) {
+        if (*s == '\0') return false;
+
+        if (*s != '\\') {
+            out->push_back(*s);
+            continue;
+        }
+
+        switch (*++s) {
+            case '"': case '\\': case '/': out->push_back(*s); break;
+            case 'b': out->push_back('\b'); break;
+            case 'f': out->push_back('\f'); break;
+            case 'n': out->push_back('\n'); break;
+            case 'r': out->push_back('\r'); break;
+            case 't': out->push_back('\t'); break;
+            case 'u':
+                for (int i = 0; i < 4; i++) {
+                    if (!isxdigit((unsigned char) s[i + 1])) return false;
+                    hex[i] = s[i + 1];
+                }
+
+                out->push_back(strtol(hex, NULL, 16) < 128 ? strtol(hex, NULL, 16) : '?');
+                s += 4;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    *p = s + 1;
+    return true;
+}
+
+static bool read_value(const char **p, struct json_value *v) {
+    double number;
+
+    v->start = *p;
+
+    if (**p == '"') {
+        v->type = json_value::STRING;
+        if (!read_string(p, &v->string)) return false;
+    } else if (**p == '[') {
+        v->type = json_value::NUMBERS;
+        v->numbers.clear();
+        (*p)++;
+        skip_space(p);
+
+        if (**p == ']') {
+            (*p)++;
+        } else {
+            while (1) {
+                if (!read_number(p, &number)) return false;
+                v->numbers.push_back((int) number);
+                skip_space(p);
+
+                if (**p == ']') break;
+                if (**p != ',') return false;
+
+                (*p)++;
+                skip_space(p);
+            }
+
+            (*p)++;
+        }
+    } else if (read_literal(p, "true") || read_literal(p, "false")) {
+        v->type = json_value::BOOLEAN;
+        v->boolean = v->start[0] == 't';
+    } else if (read_literal(p, "null")) {
+        v->type = json_value::NONE;
+    } else {
+        v->type = json_value::NUMBER;
+        if (!read_number(p, &v->number)) return false;
+    }
+
+    v->end = *p;
+    return true;
+}
+
+static bool fail(struct request *r, const char *error) {
+    r->error = error;
+    return false;
+}
+
+/*
+ * Applies a single field to a request. Ship parameters may be numbers, or
+ * null to leave them unset.
+ */
+static bool apply_field(struct request *r, const std::string &key, struct json_value &v) {
+    static const struct {
+        const char *name;
+        float Parameters::*field;
+    } floats[] = {
+        { "warp", &Parameters::warp_speed },
+        { "align", &Parameters::align_time },
+        { "gate", &Parameters::gate_cost },
+        { "jump", &Parameters::jump_range },
+        { "jump_reduction", &Parameters::jump_range_reduction },
+        { "min_security", &Parameters::min_security },
+        { "max_security", &Parameters::max_security },
+        { "safety", &Parameters::security_penalty },
+    };
+
+    for (auto const& f : floats) {
+        if (key != f.name) continue;
+        if (v.type != json_value::NUMBER && v.type != json_value::NONE) return fail(r, "ship parameters must be numbers or null");
+
+        r->parameters.*f.field = v.type == json_value::NUMBER ? v.number : NAN;
+        return true;
+    }
+
+    if (key == "id") {
+        if (v.type != json_value::NUMBER && v.type != json_value::STRING) return fail(r, "id must be a number or a string");
+        r->id = std::string(v.start, v.end);
+    } else if (key == "op") {
+        if (v.type == json_value::STRING && v.string == "route") {
+            r->op = request::ROUTE;
+        } else if (v.type == json_value::STRING && v.string == "metrics") {
+            r->op = request::METRICS;
+        } else {
+            return fail(r, "unknown op");
+        }
+    } else if (key == "src" || key == "dst") {
+        if (v.type != json_value::NUMBER) return fail(r, "src and dst must be numbers");
+        (key == "src" ? r->src : r->dst) = v.number;
+    } else if (key == "avoid" || key == "avoid_regions") {
+        if (v.type != json_value::NUMBERS) return fail(r, "avoid and avoid_regions must be arrays of ids");
+        (key == "avoid" ? r->parameters.avoided_systems : r->parameters.avoided_regions) = v.numbers;
+    } else if (key == "hierarchical") {
+        if (v.type != json_value::BOOLEAN) return fail(r, "hierarchical must be a boolean");
+        r->hierarchical = v.boolean;
+    } else if (key != "preset") {
+        return fail(r, "unknown field");
+    }
+
+    return true;
+}
+
+/*
+ * Parses a request line. Returns false and sets the error of the request if
+ * it is malformed, in which case the id is still set if it could be read.
+ */
+bool parse_request(const char *line, const Parameters &defaults, bool hierarchical, struct request *r) {
+    std::vector<std::pair<std::string, struct json_value>> fields;
+    const char *p = line;
+    int n = 0;
+
+    r->op = request::ROUTE;
+    r->id.clear();
+    r->error.clear();
+    r->src = r->dst = 0;
+    r->hierarchical = hierarchical;
+    r->parameters = defaults;
+
+    skip_space(&p);
+
+    if (*p != '{') {
+        if (sscanf(p, "%d %d %n", &r->src, &r->dst, &n) != 2 || p[n] != '\0') {
+            return fail(r, "malformed request");
+        }
+
+        return true;
+    }
+
+    p++;
+    skip_space(&p);
+
+    while (*p != '}') {
+        std::pair<std::string, struct json_value> f;
+
+        if (!read_string(&p, &f.first)) return fail(r, "malformed request");
+        skip_space(&p);
+        if (*p++ != ':') return fail(r, "malformed request");
+        skip_space(&p);
+        if (!read_value(&p, &f.second)) return fail(r, "malformed request");
+        skip_space(&p);
+
+        if (f.first == "id" && !apply_field(r, f.first, f.second)) return false;
+
+        fields.push_back(f);
+
+        if (*p == ',') {
+            p++;
+            skip_space(&p);
+        } else if (*p != '}') {
+            return fail(r, "malformed request");
+        }
+    }
+
+    p++;
+    skip_space(&p);
+
+    if (*p != '\0') return fail(r, "malformed request");
+
+    /*
+     * The preset is applied before anything else, so that the fields can
+     * override it wherever they appear.
+     */
+    for (auto &f : fields) {
+        if (f.first != "preset") continue;
+        if (f.second.type != json_value::STRING) return fail(r, "preset must be a string");
+
+        int i = 0;
+
+        while (i < preset_count && strcasecmp(presets[i].name, f.second.string.c_str()) != 0) i++;
+
+        if (i == preset_count) return fail(r, "unknown preset");
+
+        r->parameters = *presets[i].parameters;
+    }
+
+    for (auto &f : fields) {
+        if (!apply_field(r, f.first, f.second)) return false;
+    }
+
+    if (r->op == request::ROUTE && (r->src == 0 || r->dst == 0)) {
+        return fail(r, "src and dst are required");
+    }
+
+    return true;
+}
+
+static void append_number(std::string *s, double value) {
+    char buffer[64];
+
+    if (isfinite(value)) {
+        snprintf(buffer, sizeof(buffer), "%.3f", value);
+        *s += buffer;
+    } else {
+        *s += "null";
+    }
+}
+
+/*
+ * Responses repeat the id, and the origin and destination of routes, so that
+ * they can be matched with their requests even when they arrive out of order.
+ */
+static std::string start_response(const struct request &r) {
+    std::string s = r.id.empty() ? "{" : "{\"id\": " + r.id + ", ";
+
+    if (r.op == request::ROUTE && r.src && r.dst) {
+        s += "\"src\": " + std::to_string(r.src) + ", \"dst\": " + std::to_string(r.dst) + ", ";
+    }
+
+    return s;
+}
+
+/*
+ * Formats a route as a single line of JSON. A route which does not exist has
+ * a null cost and no points.
+ */
+std::string format_route(const struct request &r, Route *route) {
+    std::string s = start_response(r);
+    char buffer[128];
+
+    if (route == NULL) {
+        return s + "\"cost\": null, \"points\": []}\n";
+    }
+
+    s += "\"cost\": ";
+    append_number(&s, route->cost);
+    snprintf(buffer, sizeof(buffer), ", \"loops\": %d, \"points\": [", route->loops);
+    s += buffer;
+
+    for (unsigned int i = 0; i < route->points.size(); i++) {
+        const struct waypoint &w = route->points[i];
+
+        snprintf(buffer, sizeof(buffer), "%s{\"entity\": %d, \"system\": %d, \"type\": \"%s\", \"time\": ",
+            i ? ", " : "", w.entity->id, w.entity->system->id, movement_type_str[w.type].c_str()
+        );
+        s += buffer;
+        append_number(&s, w.time);
+        s += ", \"fatigue\": ";
+        append_number(&s, w.fatigue);
+        s += ", \"reactivation\": ";
+        append_number(&s, w.reactivation);
+        s += ", \"wait\": ";
+        append_number(&s, w.wait);
+        s += ", \"distance\": ";
+        append_number(&s, w.distance);
+        s += "}";
+    }
+
+    return s + "]}\n";
+}
+
+/*
+ * Errors are plain strings without anything that needs escaping.
+ */
+std::string format_error(const struct request &r) {
+    return start_response(r) + "\"error\": \"" + r.error + "\"}\n";
+}
+
+/*
+ * Parses and answers a request line, with a single line of JSON. The result
+ * is also stored in the last argument, if it is given.
+ */
+std::string handle_request(Universe &u, const char *line, const Parameters &defaults, bool hierarchical, enum request_result *result) {
+    enum request_result ignored;
+    struct request r;
+    Celestial *src, *dst;
+    Route *route;
+
+    if (result == NULL) result = &ignored;
+
+    *result = REQUEST_FAILED;
+
+    if (!parse_request(line, defaults, hierarchical, &r)) {
+        return format_error(r);
+    }
+
+    if (r.op == request::METRICS) {
+        *result = REQUEST_FOUND;
+        return start_response(r) + "\"metrics\": " + u.get_metrics_json() + "}\n";
+    }
+
+    if ((src = u.get_entity_or_default(r.src)) == NULL) {
+        r.error = "unknown src";
+        return format_error(r);
+    }
+
+    if ((dst = u.get_entity_or_default(r.dst)) == NULL) {
+        r.error = "unknown dst";
+        return format_error(r);
+    }
+
+    try {
+        route = r.hierarchical ? u.get_hierarchical_route(*src, *dst, &r.parameters) : u.get_route(*src, *dst, &r.parameters);
+    } catch (int e) {
+        r.error = "routing failed with error " + std::to_string(e);
+        return format_error(r);
+    }
+
+    *result = route ? REQUEST_FOUND : REQUEST_NOT_FOUND;
+
+    std::string s = format_route(r, route);
+    delete route;
+
+    return s;
+}
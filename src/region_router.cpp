@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <map>
+#include <math.h>
+
+#include "region_router.hpp"
+#include "dijkstra.hpp"
+#include "min_heap.hpp"
+
+RegionRouter::RegionRouter(Universe &u, Parameters *parameters, PrecomputeStore *store) : universe(u), parameters(*parameters) {
+    std::map<int, int> region_map;
+    std::vector<float> cost;
+    std::vector<int> prev;
+    Celestial *ent;
+    System *sys;
+    int k, edges = 0;
+
+    this->generation = u.generation;
+
+    this->region_of = new int[u.system_count];
+    this->sys_begin = new int[u.system_count];
+    this->sys_end = new int[u.system_count];
+    this->local = new int[u.get_entity_slots()];
+    this->global = new int[u.get_entity_slots()];
+
+    for (int i = 0; i < u.system_count; i++) {
+        sys = &u.systems[i];
+
+        if (region_map.find(sys->region_id) == region_map.end()) {
+            region_map[sys->region_id] = regions.size();
+            regions.push_back(Region());
+            regions.back().id = sys->region_id;
+        }
+
+        region_of[i] = region_map[sys->region_id];
+    }
+
+    for (int i = 0; i < u.system_count; i++) {
+        sys = &u.systems[i];
+        Region &r = regions[region_of[i]];
+
+        sys_begin[i] = r.nodes.size();
+
+        for (int j = 0; j < sys->entity_count; j++) {
+            ent = &sys->entities[j];
+
+            local[ent->seq_id] = -1;
+            global[ent->seq_id] = -1;
+
+            if (ent->bridge || !isnan(ent->jump_range)) has_bridges = true;
+            if (!ent->destination || ent->destination->system->removed) continue;
+
+            local[ent->seq_id] = r.nodes.size();
+            r.nodes.push_back(ent);
+
+            if (region_of[ent->destination->system->seq_id] != region_of[i]) {
+                global[ent->seq_id] = boundary.size();
+                boundary_region.push_back(region_of[i]);
+                boundary_slot.push_back(r.boundary.size());
+                r.boundary.push_back(boundary.size());
+                boundary.push_back(ent);
+            }
+        }
+
+        sys_end[i] = r.nodes.size();
+    }
+
+    /*
+     * Bridges can connect arbitrary regions and carry jump fatigue, so the
+     * boundary tables would be meaningless. The universe falls back to the
+     * flat solver in that case, so there is no need to build them.
+     */
+    if (has_bridges) return;
+
+    /*
+     * The tables are all that takes long to build, so only they are stored,
+     * one after the other, under the parameters they depend on.
+     */
+    uint64_t key = Parameters(parameters->warp_speed, parameters->align_time, parameters->gate_cost).hash();
+    unsigned long size, expected = 0;
+    const float *stored = NULL;
+
+    for (auto const& r : regions) {
+        expected += r.boundary.size() * r.boundary.size() * sizeof(float);
+    }
+
+    if (store && (stored = (const float *) store->load("region_tables", key, &size)) != NULL && size == expected) {
+        for (auto &r : regions) {
+            r.table.assign(stored, stored + r.boundary.size() * r.boundary.size());
+            stored += r.table.size();
+        }
+
+        return;
+    }
+
+    for (auto &r : regions) {
+        k = r.boundary.size();
+        r.table.resize(k * k);
+
+        for (int i = 0; i < k; i++) {
+            search(r, boundary[r.boundary[i]], cost, prev, &edges);
+
+            for (int j = 0; j < k; j++) {
+                r.table[i * k + j] = cost[local[boundary[r.boundary[j]]->seq_id]];
+            }
+        }
+    }
+
+    if (store) {
+        std::vector<float> tables;
+
+        for (auto const& r : regions) {
+            tables.insert(tables.end(), r.table.begin(), r.table.end());
+        }
+
+        store->save("region_tables", key, tables.data(), expected);
+    }
+}
+
+RegionRouter::~RegionRouter() {
+    delete[] region_of;
+    delete[] sys_begin;
+    delete[] sys_end;
+    delete[] local;
+    delete[] global;
+}
+
+bool RegionRouter::is_applicable(Parameters *parameters) {
+    return isnan(parameters->jump_range) && !isnan(parameters->gate_cost) &&
+           isnan(parameters->min_security) && isnan(parameters->max_security) &&
+           parameters->security_penalty == 0.0 &&
+           parameters->avoided_systems.empty() && parameters->avoided_regions.empty();
+}
+
+float RegionRouter::get_warp_time(Celestial *a, Celestial *b) {
+    float dx = a->x - b->x;
+    float dy = a->y - b->y;
+    float dz = a->z - b->z;
+
+    return parameters.align_time + Dijkstra::get_time(parameters.warp_speed, sqrt(dx * dx + dy * dy + dz * dz));
+}
+
+/*
+ * Runs a Dijkstra search which never leaves the given region, starting from
+ * an origin inside of it. The origin does not need to be a node of the region
+ * graph; if it is not, the search is seeded with warps to the nodes in the
+ * origin system. Returns the number of settled nodes, and adds the number of
+ * edges considered to the given counter.
+ */
+int RegionRouter::search(Region &r, Celestial *origin, std::vector<float> &cost, std::vector<int> &prev, int *edges) {
+    int n = r.nodes.size(), settled = 0, o = local[origin->seq_id], u, v, s;
+    float c;
+    Celestial *ent;
+
+    MinHeap<float, int> queue(n);
+
+    cost.assign(n, INFINITY);
+    prev.assign(n, -1);
+
+    if (o != -1) {
+        cost[o] = 0.0;
+        prev[o] = -2;
+    } else {
+        s = origin->system->seq_id;
+
+        for (v = sys_begin[s]; v < sys_end[s]; v++) {
+            cost[v] = get_warp_time(origin, r.nodes[v]);
+            prev[v] = -2;
+        }
+    }
+
+    for (v = 0; v < n; v++) {
+        queue.insert(cost[v], v);
+    }
+
+    while (!queue.is_empty()) {
+        u = queue.extract();
+
+        if (isinf(cost[u])) break;
+
+        ent = r.nodes[u];
+        s = ent->system->seq_id;
+        settled++;
+        *edges += sys_end[s] - sys_begin[s];
+
+        for (v = sys_begin[s]; v < sys_end[s]; v++) {
+            if (v != u && (c = cost[u] + get_warp_time(ent, r.nodes[v])) < cost[v]) {
+                cost[v] = c;
+                prev[v] = u;
+                queue.decrease_raw(c, v);
+            }
+        }
+
+        if (global[ent->seq_id] == -1 && (v = local[ent->destination->seq_id]) != -1) {
+            (*edges)++;
+
+            if ((c = cost[u] + parameters.gate_cost) < cost[v]) {
+                cost[v] = c;
+                prev[v] = u;
+                queue.decrease_raw(c, v);
+            }
+        }
+    }
+
+    return settled;
+}
+
+/*
+ * Given the result of a search from the origin, returns the cost of reaching
+ * a target in the same region. The node from which the final warp to the
+ * target starts is written to via, or -2 if the origin warps there directly.
+ */
+float RegionRouter::get_cost_to(Region &r, std::vector<float> &cost, Celestial *origin, Celestial *target, int *via) {
+    int t = local[target->seq_id], s = target->system->seq_id;
+    float c, best = INFINITY;
+
+    *via = -1;
+
+    if (t != -1) {
+        *via = t;
+        return cost[t];
+    }
+
+    if (origin->system == target->system) {
+        best = get_warp_time(origin, target);
+        *via = -2;
+    }
+
+    for (int v = sys_begin[s]; v < sys_end[s]; v++) {
+        if ((c = cost[v] + get_warp_time(r.nodes[v], target)) < best) {
+            best = c;
+            *via = v;
+        }
+    }
+
+    return best;
+}
+
+void RegionRouter::unpack(Region &r, std::vector<int> &prev, int target, std::vector<Celestial *> &path) {
+    std::vector<Celestial *> tmp;
+
+    for (int v = target; v >= 0; v = prev[v]) {
+        tmp.push_back(r.nodes[v]);
+    }
+
+    path.insert(path.end(), tmp.rbegin(), tmp.rend());
+}
+
+/*
+ * Routes between two entities by searching locally in the origin and
+ * destination regions, and connecting the two over the overlay graph of
+ * boundary stargates. The in-region legs of the resulting overlay path are
+ * then expanded with another local search each.
+ */
+Route *RegionRouter::get_route(Celestial *src, Celestial *dst) {
+    std::vector<float> cost_s, cost_d, cost, dist;
+    std::vector<int> prev_s, prev_d, prev_r, prev, chain;
+    std::vector<Celestial *> path;
+    Celestial *a, *b;
+    float best = INFINITY, c, time = 0.0;
+    int loops = 0, edges = 0, best_g = -1, best_via = -1, g, h, i, k, n = boundary.size();
+
+    int src_region = region_of[src->system->seq_id];
+    int dst_region = region_of[dst->system->seq_id];
+
+    Region &rs = regions[src_region], &rd = regions[dst_region];
+
+    loops += search(rs, src, cost_s, prev_s, &edges);
+    loops += search(rd, dst, cost_d, prev_d, &edges);
+
+    if (src == dst) {
+        best = 0.0;
+    } else if (src_region == dst_region) {
+        best = get_cost_to(rs, cost_s, src, dst, &best_via);
+    }
+
+    MinHeap<float, int> queue(n);
+
+    dist.assign(n, INFINITY);
+    prev.assign(n, -1);
+
+    for (auto const& j : rs.boundary) {
+        dist[j] = cost_s[local[boundary[j]->seq_id]];
+        prev[j] = -2;
+    }
+
+    for (g = 0; g < n; g++) {
+        queue.insert(dist[g], g);
+    }
+
+    while (!queue.is_empty()) {
+        g = queue.extract();
+
+        if (dist[g] >= best) break;
+
+        loops++;
+
+        if (boundary_region[g] == dst_region && (c = dist[g] + cost_d[local[boundary[g]->seq_id]]) < best) {
+            best = c;
+            best_g = g;
+        }
+
+        if ((h = global[boundary[g]->destination->seq_id]) != -1 && (c = dist[g] + parameters.gate_cost) < dist[h]) {
+            dist[h] = c;
+            prev[h] = g;
+            queue.decrease_raw(c, h);
+        }
+
+        Region &r = regions[boundary_region[g]];
+        k = r.boundary.size();
+        i = boundary_slot[g];
+        edges += k + 1;
+
+        for (int j = 0; j < k; j++) {
+            if ((h = r.boundary[j]) != g && (c = dist[g] + r.table[i * k + j]) < dist[h]) {
+                dist[h] = c;
+                prev[h] = g;
+                queue.decrease_raw(c, h);
+            }
+        }
+    }
+
+    if (isinf(best)) return NULL;
+
+    path.push_back(src);
+
+    if (best_g == -1) {
+        if (best_via >= 0) unpack(rs, prev_s, best_via, path);
+    } else {
+        for (g = best_g; g >= 0; g = prev[g]) {
+            chain.push_back(g);
+        }
+
+        std::reverse(chain.begin(), chain.end());
+
+        unpack(rs, prev_s, local[boundary[chain.front()]->seq_id], path);
+
+        for (unsigned int j = 1; j < chain.size(); j++) {
+            a = boundary[chain[j - 1]];
+            b = boundary[chain[j]];
+
+            if (a->destination == b) {
+                path.push_back(b);
+            } else {
+                Region &r = regions[boundary_region[chain[j]]];
+                loops += search(r, a, cost, prev_r, &edges);
+                unpack(r, prev_r, local[b->seq_id], path);
+            }
+        }
+
+        for (g = local[boundary[chain.back()]->seq_id]; g >= 0; g = prev_d[g]) {
+            path.push_back(rd.nodes[g]);
+        }
+    }
+
+    path.push_back(dst);
+    path.erase(std::unique(path.begin(), path.end()), path.end());
+
+    Route *route = new Route();
+
+    route->loops = loops;
+    route->edges = edges;
+    route->points.reserve(path.size());
+
+    for (unsigned int j = 0; j < path.size(); j++) {
+        struct waypoint point = {
+            .entity = path[j],
+            .type = STRT,
+            .time = 0.0,
+            .fatigue = 0.0,
+            .reactivation = 0.0,
+            .wait = 0.0,
+            .distance = NAN,
+        };
+
+        if (j > 0) {
+            a = path[j - 1];
+
+            if (a->destination == path[j]) {
+                point.type = GATE;
+                time += parameters.gate_cost;
+            } else {
+                point.type = WARP;
+                time += get_warp_time(a, path[j]);
+            }
+
+            point.time = time;
+        }
+
+        route->points.push_back(point);
+    }
+
+    route->cost = time;
+
+    return route;
+}
@@ -0,0 +1,63 @@
+#include <math.h>
+
+#include "universe.hpp"
+
+static_assert(sizeof(struct route_record) == 32, "the route record layout is fixed");
+
+RouteBatch::RouteBatch() {
+    offsets.push_back(0);
+}
+
+void RouteBatch::append(Route *route) {
+    if (route) {
+        records.reserve(records.size() + route->points.size());
+
+        for (auto const& p : route->points) {
+            records.push_back((struct route_record) {
+                .entity_id = p.entity->id,
+                .system_id = p.entity->system->id,
+                .type = p.type,
+                .time = p.time,
+                .fatigue = p.fatigue,
+                .reactivation = p.reactivation,
+                .wait = p.wait,
+                .distance = p.distance,
+            });
+        }
+    }
+
+    offsets.push_back(records.size());
+    costs.push_back(route ? route->cost : NAN);
+}
+
+/*
+ * Empties the batch but keeps its memory, so that it can be filled again
+ * without allocating.
+ */
+void RouteBatch::clear() {
+    records.clear();
+    offsets.resize(1);
+    costs.clear();
+}
+
+int RouteBatch::size() {
+    return costs.size();
+}
+
+unsigned long RouteBatch::get_records_address() {
+    return (unsigned long) records.data();
+}
+
+unsigned long RouteBatch::get_offsets_address() {
+    return (unsigned long) offsets.data();
+}
+
+unsigned long RouteBatch::get_costs_address() {
+    return (unsigned long) costs.data();
+}
+
+RouteBatch *Route::as_batch() {
+    RouteBatch *res = new RouteBatch();
+    res->append(this);
+    return res;
+}
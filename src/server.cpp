@@ -0,0 +1,364 @@
+#include <string>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.hpp"
+#include "protocol.hpp"
+
+/*
+ * Reading from a client pauses while this many of its requests are waiting
+ * to be answered or sent, and answered requests wait while this much output
+ * is waiting to be written, which bounds the memory of a single client.
+ */
+#define MAX_PIPELINE 1024
+#define MAX_OUTPUT 65536
+#define MAX_LINE 65536
+
+#define LISTEN_EVENT -1
+#define WAKE_EVENT -2
+#define SIGNAL_EVENT -3
+
+Server::Server(Universe &u, const Parameters &p, bool h, int workers): universe(u), parameters(p), hierarchical(h), worker_count(workers) {
+}
+
+Server::~Server() {
+    for (auto const& c : connections) {
+        close(c.second->fd);
+        delete c.second;
+    }
+
+    if (listen_fd >= 0) close(listen_fd);
+    if (epoll_fd >= 0) close(epoll_fd);
+    if (wake_fd >= 0) close(wake_fd);
+    if (signal_fd >= 0) close(signal_fd);
+
+    if (!unix_path.empty()) unlink(unix_path.c_str());
+}
+
+/*
+ * Listens on a Unix domain socket if the address contains a slash, and on a
+ * TCP port otherwise. A bare port number listens on localhost only.
+ */
+bool Server::listen(const char *address) {
+    const char *colon = strrchr(address, ':');
+    int one = 1;
+
+    if (strchr(address, '/')) {
+        struct sockaddr_un a = {};
+
+        a.sun_family = AF_UNIX;
+
+        if (strlen(address) >= sizeof(a.sun_path)) {
+            fprintf(stderr, "Socket path %s is too long\n", address);
+            return false;
+        }
+
+        strcpy(a.sun_path, address);
+        unlink(address);
+
+        if ((listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 || bind(listen_fd, (struct sockaddr *) &a, sizeof(a)) != 0) {
+            fprintf(stderr, "Could not listen on %s: %s\n", address, strerror(errno));
+            return false;
+        }
+
+        unix_path = address;
+    } else {
+        struct sockaddr_in a = {};
+        std::string host = colon ? std::string(address, colon - address) : "127.0.0.1";
+
+        a.sin_family = AF_INET;
+        a.sin_port = htons(atoi(colon ? colon + 1 : address));
+
+        if (inet_pton(AF_INET, host.c_str(), &a.sin_addr) != 1) {
+            fprintf(stderr, "Could not parse the address %s\n", address);
+            return false;
+        }
+
+        if ((listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+            setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+            bind(listen_fd, (struct sockaddr *) &a, sizeof(a)) != 0) {
+            fprintf(stderr, "Could not listen on %s: %s\n", address, strerror(errno));
+            return false;
+        }
+    }
+
+    if (::listen(listen_fd, 128) != 0) {
+        fprintf(stderr, "Could not listen on %s: %s\n", address, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static void add_event(int epoll_fd, int fd, int id, int events) {
+    struct epoll_event e = {};
+
+    e.events = events;
+    e.data.fd = id;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &e);
+}
+
+void Server::run() {
+    struct epoll_event events[64];
+    sigset_t signals;
+
+    /*
+     * The signals are blocked before the workers start, so that only the
+     * event loop receives them, through its signal descriptor.
+     */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    add_event(epoll_fd, listen_fd, LISTEN_EVENT, EPOLLIN);
+    add_event(epoll_fd, wake_fd, WAKE_EVENT, EPOLLIN);
+    add_event(epoll_fd, signal_fd, SIGNAL_EVENT, EPOLLIN);
+
+    for (int i = 0; i < worker_count; i++) {
+        workers.push_back(std::thread(&Server::work, this));
+    }
+
+    while (!stopping) {
+        int n = epoll_wait(epoll_fd, events, 64, -1);
+
+        for (int i = 0; i < n && !stopping; i++) {
+            int id = events[i].data.fd;
+
+            if (id == LISTEN_EVENT) {
+                accept_connection();
+            } else if (id == SIGNAL_EVENT) {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            } else if (id == WAKE_EVENT) {
+                std::vector<int> ready;
+                uint64_t count;
+
+                if (read(wake_fd, &count, sizeof(count)) < 0) continue;
+
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    ready.swap(finished);
+                }
+
+                std::sort(ready.begin(), ready.end());
+                ready.erase(std::unique(ready.begin(), ready.end()), ready.end());
+
+                for (int c : ready) {
+                    if (connections.count(c)) flush_connection(c);
+                }
+            } else if (connections.count(id)) {
+                if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN)) {
+                    close_connection(id);
+                    continue;
+                }
+
+                if (events[i].events & EPOLLIN) read_connection(id);
+                if (connections.count(id)) flush_connection(id);
+            }
+        }
+    }
+
+    available.notify_all();
+
+    for (auto &w : workers) {
+        w.join();
+    }
+
+    workers.clear();
+}
+
+void Server::accept_connection() {
+    int fd;
+
+    while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        struct server_connection *c = new server_connection();
+        int id = next_connection++;
+
+        c->fd = fd;
+        c->events = EPOLLIN;
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            connections[id] = c;
+        }
+
+        add_event(epoll_fd, fd, id, EPOLLIN);
+    }
+}
+
+/*
+ * Reads what the client sent, and queues every complete line as a job. The
+ * rest of a request which ends without a newline is taken as a last line.
+ */
+void Server::read_connection(int id) {
+    struct server_connection *c = connections[id];
+    std::vector<struct server_job> lines;
+    char buffer[65536];
+    ssize_t n = recv(c->fd, buffer, sizeof(buffer), 0);
+    size_t start = 0, end;
+
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EINTR) close_connection(id);
+        return;
+    }
+
+    c->input.append(buffer, n);
+    c->eof = n == 0;
+
+    if (c->eof && !c->input.empty() && c->input.back() != '\n') {
+        c->input += '\n';
+    }
+
+    while ((end = c->input.find('\n', start)) != std::string::npos) {
+        std::string line = c->input.substr(start, end - start);
+
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        start = end + 1;
+
+        if (line.find_first_not_of(" \t") == std::string::npos) continue;
+
+        lines.push_back({ id, c->received++, line });
+    }
+
+    c->input.erase(0, start);
+
+    if (c->input.size() > MAX_LINE) {
+        close_connection(id);
+        return;
+    }
+
+    if (!lines.empty()) {
+        std::lock_guard<std::mutex> guard(lock);
+        jobs.insert(jobs.end(), lines.begin(), lines.end());
+    }
+
+    for (unsigned int i = 0; i < lines.size(); i++) {
+        available.notify_one();
+    }
+}
+
+/*
+ * Moves the responses which are next in line to the output, and writes them
+ * until the socket takes no more or there is nothing left to send.
+ */
+void Server::flush_connection(int id) {
+    struct server_connection *c = connections[id];
+    bool blocked = false;
+    ssize_t n;
+
+    while (!blocked) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            while (c->output.size() < MAX_OUTPUT && !c->responses.empty() && c->responses.begin()->first == c->sent) {
+                c->output += c->responses.begin()->second;
+                c->responses.erase(c->responses.begin());
+                c->sent++;
+            }
+        }
+
+        if (c->output.empty()) break;
+
+        while (!c->output.empty()) {
+            if ((n = send(c->fd, c->output.data(), c->output.size(), MSG_NOSIGNAL)) < 0) {
+                if (errno != EAGAIN && errno != EINTR) {
+                    close_connection(id);
+                    return;
+                }
+
+                blocked = errno == EAGAIN;
+                break;
+            }
+
+            c->output.erase(0, n);
+        }
+    }
+
+    if (c->eof && c->sent == c->received && c->output.empty()) {
+        close_connection(id);
+    } else {
+        update_events(id);
+    }
+}
+
+void Server::update_events(int id) {
+    struct server_connection *c = connections[id];
+    struct epoll_event e = {};
+    int events = 0;
+
+    if (!c->eof && c->received - c->sent < MAX_PIPELINE) events |= EPOLLIN;
+    if (!c->output.empty()) events |= EPOLLOUT;
+
+    if (events != c->events) {
+        e.events = events;
+        e.data.fd = id;
+
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &e);
+        c->events = events;
+    }
+}
+
+void Server::close_connection(int id) {
+    struct server_connection *c = connections[id];
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        connections.erase(id);
+    }
+
+    close(c->fd);
+    delete c;
+}
+
+/*
+ * Routes queued requests until the server stops. Requests of clients which
+ * have gone away meanwhile are dropped.
+ */
+void Server::work() {
+    std::unique_lock<std::mutex> guard(lock);
+    uint64_t one = 1;
+
+    while (1) {
+        available.wait(guard, [this]() { return stopping || !jobs.empty(); });
+
+        if (stopping) return;
+
+        struct server_job job = jobs.front();
+        jobs.pop_front();
+
+        if (!connections.count(job.connection)) continue;
+
+        guard.unlock();
+        std::string response = handle_request(universe, job.line.c_str(), parameters, hierarchical);
+        guard.lock();
+
+        auto i = connections.find(job.connection);
+
+        if (i != connections.end()) {
+            i->second->responses[job.sequence] = response;
+            finished.push_back(job.connection);
+
+            while (write(wake_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+        }
+    }
+}
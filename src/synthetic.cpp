@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <set>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "synthetic.hpp"
+#include "kernels.hpp"
+
+/*
+ * Systems are linked to the nearest systems within this many places of
+ * themselves along the Morton curve.
+ */
+#define LINK_WINDOW 32
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+static double next_uniform(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint32_t interleave(uint32_t v) {
+    v &= 0xffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+
+    return v;
+}
+
+struct synthetic_system {
+    double x, y, z;
+    float security;
+    uint32_t morton;
+    int region, celestials, stations, gates;
+};
+
+Universe *SyntheticUniverse::generate() {
+    std::vector<struct synthetic_system> sys(systems);
+    std::set<std::pair<int, int>> links;
+    uint64_t rng = seed * 0x9E3779B97F4A7C15ull + 1;
+    int total = 0, celestials = 0, stations = 0, celestial_id = 40000000, stargate_id = 50000000, station_id = 60000000;
+    char name[128];
+
+    if (systems <= 0 || systems > 10000000 || entities < 1 || density <= 0 || region_size < 1) {
+        throw 34;
+    }
+
+    /*
+     * The box is eight times as wide and deep as it is high, much like New
+     * Eden itself.
+     */
+    double side = cbrt(8.0 * systems / density);
+
+    for (auto &s : sys) {
+        s.x = (next_uniform(&rng) - 0.5) * side;
+        s.y = (next_uniform(&rng) - 0.5) * side / 8;
+        s.z = (next_uniform(&rng) - 0.5) * side;
+        s.morton = interleave((s.x / side + 0.5) * 65535) | (interleave((s.z / side + 0.5) * 65535) << 1);
+        s.gates = 0;
+    }
+
+    std::sort(sys.begin(), sys.end(), [](const struct synthetic_system &a, const struct synthetic_system &b) {
+        return a.morton < b.morton;
+    });
+
+    for (int i = 0; i < systems; i++) {
+        if (i % region_size == 0) {
+            sys[i].security = next_uniform(&rng) * 2 - 1;
+        } else {
+            sys[i].security = sys[i - 1].security;
+        }
+
+        sys[i].region = i / region_size;
+    }
+
+    for (int i = 0; i < systems; i++) {
+        sys[i].security = std::min(1.0, std::max(-1.0, round((sys[i].security + next_uniform(&rng) * 0.4 - 0.2) * 10) / 10));
+    }
+
+    for (int i = 0; i + 1 < systems; i++) {
+        links.insert(std::make_pair(i, i + 1));
+    }
+
+    /*
+     * The chain accounts for an average degree of two, the remaining degree
+     * is made up of links to the nearest systems along the curve.
+     */
+    double extra = std::max(0.0, degree / 2.0 - 1);
+
+    for (int i = 0; i < systems; i++) {
+        std::vector<std::pair<double, int>> near;
+        int count = (int) extra + (next_uniform(&rng) < extra - (int) extra ? 1 : 0);
+
+        for (int j = std::max(0, i - LINK_WINDOW); j < std::min(systems, i + LINK_WINDOW + 1); j++) {
+            if (j == i || j == i - 1 || j == i + 1) continue;
+
+            near.push_back(std::make_pair(
+                pow(sys[i].x - sys[j].x, 2) + pow(sys[i].y - sys[j].y, 2) + pow(sys[i].z - sys[j].z, 2), j
+            ));
+        }
+
+        std::sort(near.begin(), near.end());
+
+        for (int k = 0; k < count && k < (int) near.size(); k++) {
+            links.insert(std::make_pair(std::min(i, near[k].second), std::max(i, near[k].second)));
+        }
+    }
+
+    for (auto const& l : links) {
+        sys[l.first].gates++;
+        sys[l.second].gates++;
+    }
+
+    for (auto &s : sys) {
+        s.stations = next_uniform(&rng) < 0.3 ? 1 : 0;
+        s.celestials = std::max(1, entities - s.gates - s.stations);
+
+        celestials += s.celestials;
+        stations += s.stations;
+        total += s.celestials + s.gates + s.stations;
+    }
+
+    /*
+     * Every kind of entity has a range of ten million identifiers.
+     */
+    if (celestials > 10000000 || stations > 10000000 || links.size() > 5000000) {
+        throw 34;
+    }
+
+    Universe *u = new Universe(systems, total);
+
+    for (int i = 0; i < systems; i++) {
+        struct synthetic_system &s = sys[i];
+
+        snprintf(name, sizeof(name), "S-%07d", i);
+
+        u->add_system(30000000 + i, name, s.x * LY_TO_M, s.y * LY_TO_M, s.z * LY_TO_M, s.celestials + s.gates + s.stations, s.security, 10000000 + s.region);
+    }
+
+    /*
+     * The first celestial of every system is its sun, the rest are planets
+     * on a flat disc of up to 50 AU around it.
+     */
+    for (int i = 0; i < systems; i++) {
+        System *s = u->get_system(30000000 + i);
+
+        for (int j = 0; j < sys[i].celestials; j++) {
+            double r = j == 0 ? 0.0 : next_uniform(&rng) * 50 * AU_TO_M;
+            double a = next_uniform(&rng) * 2 * M_PI;
+
+            snprintf(name, sizeof(name), j == 0 ? "%s - Star" : "%s %d", s->name.get(), j);
+
+            Celestial *e = u->add_entity(s->id, celestial_id++, CELESTIAL, name, s->x + r * cos(a), s->y, s->z + r * sin(a), NULL);
+            e->group_id = j == 0 ? 6 : 7;
+        }
+    }
+
+    snprintf(name, sizeof(name), "Stargate");
+
+    for (auto const& l : links) {
+        Celestial *gates[2];
+        int ends[2] = { l.first, l.second };
+
+        for (int k = 0; k < 2; k++) {
+            System *s = u->get_system(30000000 + ends[k]);
+            double r = (1 + next_uniform(&rng) * 40) * AU_TO_M, a = next_uniform(&rng) * 2 * M_PI;
+
+            gates[k] = u->add_entity(s->id, stargate_id++, STARGATE, name, s->x + r * cos(a), s->y, s->z + r * sin(a), NULL);
+        }
+
+        u->add_stargate(gates[0], gates[1]);
+        u->add_stargate(gates[1], gates[0]);
+    }
+
+    for (int i = 0; i < systems; i++) {
+        System *s = u->get_system(30000000 + i);
+
+        if (sys[i].stations == 0) continue;
+
+        Celestial *planet = &s->entities[next_random(&rng) % sys[i].celestials];
+
+        snprintf(name, sizeof(name), "%s - Station", planet->name.get());
+
+        u->add_entity(s->id, station_id++, STATION, name, planet->x + 1E7, planet->y, planet->z, NULL);
+    }
+
+    u->sort_systems();
+
+    return u;
+}
@@ -1,18 +1,50 @@
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <new>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "universe.hpp"
 #include "dijkstra.hpp"
+#include "region_router.hpp"
+#include "jump_graph.hpp"
+#include "precompute_store.hpp"
+
+#define NAME_BLOCK_SIZE 65536
+#define JOURNAL_SIZE 4096
+#define JUMP_GRAPH_CACHE 16
+
+#define SHARED_MAGIC "EVENERD"
+#define SHARED_VERSION 2
+#define SHARED_ALIGN(n) (((n) + 63) & ~63ul)
+
+/*
+ * The start of a file written by export_shared. The offsets of the tables
+ * are relative to the start of the file, and the sizes of the classes guard
+ * against attaching a file written by an incompatible build.
+ */
+struct shared_header {
+    char magic[8];
+    int version, system_size, entity_size;
+    int system_count, entity_count, entity_slots, stargate_count, sorted_systems, max_system_entities;
+    unsigned long systems, entities, names, size;
+};
 
 System *Universe::get_system(int id) {
-    return this->systems + this->system_map[id];
+    auto i = this->system_map.find(id);
+    return i == this->system_map.end() ? NULL : this->systems + i->second;
 }
 
 Celestial *Universe::get_entity(int id) {
-    return this->entities + this->entity_map[id];
+    auto i = this->entity_map.find(id);
+    return i == this->entity_map.end() ? NULL : this->entities + i->second;
 }
 
 System *Universe::get_system_by_seq_id(int id) {
@@ -28,7 +60,7 @@ Celestial *Universe::get_entity_or_default(int id) {
     Celestial *ent = NULL;
 
     if (id >= 30000000 && id < 40000000) {
-        sys = this->get_system(id);
+        if ((sys = this->get_system(id)) == NULL) return NULL;
 
         for (int i = 0; i < sys->entity_count; i++) {
             if (sys->entities[i].type == STATION) {
@@ -46,15 +78,23 @@ Celestial *Universe::get_entity_or_default(int id) {
 }
 
 Route *Universe::get_route(int src_id, int dst_id, Parameters *param) {
-    return this->get_route(
-        *this->get_entity_or_default(src_id),
-        *this->get_entity_or_default(dst_id),
-        param
-    );
+    Celestial *src = this->get_entity_or_default(src_id), *dst = this->get_entity_or_default(dst_id);
+
+    if (src == NULL || dst == NULL) {
+        throw 33;
+    }
+
+    return this->get_route(*src, *dst, param);
 }
 
 Route *Universe::get_route(Celestial &src, Celestial &dst, Parameters *param) {
-    return Dijkstra(*this, &src, &dst, param).get_route();
+    struct timespec start;
+
+    metrics.start(&start);
+    Route *route = Dijkstra(*this, &src, &dst, param).get_route();
+    metrics.record_query(param, &start, route != NULL);
+
+    return route;
 }
 
 Route *Universe::get_route(std::vector<int> points, Parameters *param) {
@@ -67,31 +107,396 @@ Route *Universe::get_route(std::vector<int> points, Parameters *param) {
     return get_route(as_celestials, param);
 }
 
+/*
+ * Appends the route between two entities to a batch, without a Route in
+ * between. Returns whether there is a route.
+ */
+bool Universe::append_route(Celestial &src, Celestial &dst, Parameters *param, RouteBatch *batch) {
+    struct timespec start;
+
+    metrics.start(&start);
+    bool found = Dijkstra(*this, &src, &dst, param).append_route(batch);
+    metrics.record_query(param, &start, found);
+
+    return found;
+}
+
+/*
+ * Routes between every pair of origin and destination at the same position
+ * in the two lists, and collects the routes into a single batch. Queries
+ * only read the universe, so the pairs are routed in parallel. Every thread
+ * writes its routes into a batch of its own, which only grows a few times
+ * over the whole call, and once all are routed the threads copy them to
+ * their places in the result.
+ */
+RouteBatch *Universe::get_route_batch(std::vector<int> src, std::vector<int> dst, Parameters *param) {
+    std::vector<int> slots(src.size());
+    RouteBatch *res = new RouteBatch();
+
+    if (src.size() != dst.size()) {
+        delete res;
+        throw 40;
+    }
+
+    res->offsets.resize(src.size() + 1);
+    res->costs.resize(src.size());
+
+    #pragma omp parallel
+    {
+        RouteBatch part;
+        std::vector<int> mine;
+
+        #pragma omp for schedule(dynamic)
+        for (unsigned int i = 0; i < src.size(); i++) {
+            Celestial *src_e = get_entity_or_default(src[i]);
+            Celestial *dst_e = get_entity_or_default(dst[i]);
+
+            slots[i] = part.size();
+            mine.push_back(i);
+
+            if (src_e && dst_e) {
+                append_route(*src_e, *dst_e, param, &part);
+            } else {
+                part.append(NULL);
+            }
+
+            res->offsets[i + 1] = part.offsets[slots[i] + 1] - part.offsets[slots[i]];
+            res->costs[i] = part.costs[slots[i]];
+        }
+
+        #pragma omp single
+        {
+            for (unsigned int i = 0; i < src.size(); i++) {
+                res->offsets[i + 1] += res->offsets[i];
+            }
+
+            res->records.resize(res->offsets.back());
+        }
+
+        for (auto const& i : mine) {
+            std::copy(
+                part.records.begin() + part.offsets[slots[i]], part.records.begin() + part.offsets[slots[i] + 1],
+                res->records.begin() + res->offsets[i]
+            );
+        }
+    }
+
+    return res;
+}
+
 Route *Universe::get_route(std::vector<Celestial *> points, Parameters *param) {
     Route *res = NULL, *tmp;
 
+    for (auto const& point : points) {
+        if (point == NULL) {
+            throw 33;
+        }
+    }
+
     for(unsigned int i = 0; i != points.size() - 1; i++) {
         tmp = get_route(*points[i], *points[i + 1], param);
 
+        if (tmp == NULL) {
+            delete res;
+            return NULL;
+        }
+
         if (res == NULL) {
             res = tmp;
         } else {
             res->concatenate(*tmp);
+            delete tmp;
         }
     }
 
     return res;
 }
 
+Route *Universe::get_hierarchical_route(int src_id, int dst_id, Parameters *param) {
+    Celestial *src = this->get_entity_or_default(src_id), *dst = this->get_entity_or_default(dst_id);
+
+    if (src == NULL || dst == NULL) {
+        throw 33;
+    }
+
+    return this->get_hierarchical_route(*src, *dst, param);
+}
+
+Route *Universe::get_hierarchical_route(Celestial &src, Celestial &dst, Parameters *param) {
+    RegionRouter *router;
+
+    struct timespec start;
+
+    if (!RegionRouter::is_applicable(param) || (router = get_region_router(param))->has_bridges) {
+        return get_route(src, dst, param);
+    }
+
+    metrics.start(&start);
+    Route *route = router->get_route(&src, &dst);
+    metrics.record_query(param, &start, route != NULL);
+
+    return route;
+}
+
+std::vector<Route *> Universe::get_alternative_routes(int src_id, int dst_id, int k, Parameters *param) {
+    Celestial *src = this->get_entity_or_default(src_id), *dst = this->get_entity_or_default(dst_id);
+
+    if (src == NULL || dst == NULL) {
+        throw 33;
+    }
+
+    return this->get_alternative_routes(*src, *dst, k, param);
+}
+
+/*
+ * The shortest route and up to k - 1 alternatives through other systems,
+ * shortest first, for when the shortest one is camped.
+ */
+std::vector<Route *> Universe::get_alternative_routes(Celestial &src, Celestial &dst, int k, Parameters *param) {
+    struct timespec start;
+
+    metrics.start(&start);
+    std::vector<Route *> routes = Dijkstra(*this, &src, &dst, param).get_alternative_routes(k);
+    metrics.record_query(param, &start, !routes.empty());
+
+    return routes;
+}
+
+/*
+ * The jump graph for a jump range, built on first use. A graph stays valid
+ * through every change the journal records, as none of them moves a system,
+ * and is built again after anything else. Searches may still be using the
+ * old one, so it is only freed along with the universe. Only so many ranges
+ * are kept; searches with any other range return NULL, and scan instead.
+ */
+JumpGraph *Universe::get_jump_graph(float range) {
+    std::lock_guard<std::mutex> guard(jump_graph_lock);
+    std::vector<struct graph_change> changes;
+    auto i = jump_graphs.find(range);
+
+    if (i != jump_graphs.end()) {
+        if (i->second->generation == generation || get_changes(i->second->generation, &changes)) {
+            i->second->generation = generation;
+            metrics.record_cache(CACHE_JUMP_GRAPH, true);
+            return i->second;
+        }
+
+        retired_jump_graphs.push_back(i->second);
+    } else if (jump_graphs.size() >= JUMP_GRAPH_CACHE) {
+        return NULL;
+    }
+
+    metrics.record_cache(CACHE_JUMP_GRAPH, false);
+
+    return jump_graphs[range] = new JumpGraph(*this, range, get_store());
+}
+
+/*
+ * The region router for a ship, built on first use and again after every
+ * change. As with jump graphs, searches may still be using a stale one, so
+ * it is only freed along with the universe.
+ */
+RegionRouter *Universe::get_region_router(Parameters *param) {
+    std::lock_guard<std::mutex> guard(region_router_lock);
+    auto key = std::make_tuple(param->warp_speed, param->align_time, param->gate_cost);
+    auto i = region_routers.find(key);
+
+    if (i != region_routers.end()) {
+        if (i->second->generation == generation) {
+            metrics.record_cache(CACHE_REGION_ROUTER, true);
+            return i->second;
+        }
+
+        retired_region_routers.push_back(i->second);
+    }
+
+    metrics.record_cache(CACHE_REGION_ROUTER, false);
+
+    return region_routers[key] = new RegionRouter(*this, param, get_store());
+}
+
+/*
+ * Keeps precomputed data in the given directory, for this universe as it is
+ * now. Everything is read from there if it was computed before, by this or
+ * any other process with the same map, and written there otherwise. Once
+ * the universe changes, the store is no longer used. A store which is
+ * replaced stays open, as cached jump graphs may still be mapped from it.
+ */
+void Universe::open_store(std::string directory) {
+    PrecomputeStore *s = new PrecomputeStore(directory, get_checksum());
+
+    std::lock_guard<std::mutex> guard(region_router_lock);
+    std::lock_guard<std::mutex> graph_guard(jump_graph_lock);
+
+    if (store) retired_stores.push_back(store);
+
+    store = s;
+    store_generation = generation;
+}
+
+PrecomputeStore *Universe::get_store() {
+    return store && store_generation == generation ? store : NULL;
+}
+
+/*
+ * A checksum of everything routes depend on, in the order of the tables.
+ * Loading the same SDE files gives the same checksum, and so does attaching
+ * a universe exported from them.
+ */
+uint64_t Universe::get_checksum() {
+    uint64_t h = fnv1a(&system_count, sizeof(system_count));
+
+    for (int i = 0; i < system_count; i++) {
+        System *s = &systems[i];
+        float values[] = { s->x, s->y, s->z, s->security };
+        int ints[] = { s->id, s->entity_count, s->region_id, s->removed };
+
+        h = fnv1a(values, sizeof(values), h);
+        h = fnv1a(ints, sizeof(ints), h);
+
+        for (int j = 0; j < s->entity_count; j++) {
+            Celestial *e = &s->entities[j];
+            float evalues[] = { e->x, e->y, e->z, e->jump_range };
+            int eints[] = {
+                e->id, e->type, e->group_id,
+                e->destination ? e->destination->seq_id : -1,
+                e->bridge ? e->bridge->seq_id : -1,
+            };
+
+            h = fnv1a(evalues, sizeof(evalues), h);
+            h = fnv1a(eints, sizeof(eints), h);
+        }
+    }
+
+    return h;
+}
+
 std::map<Celestial *, float> *Universe::get_all_distances(int src_id, Parameters *param) {
-    return this->get_all_distances(
-        *this->get_entity_or_default(src_id),
-        param
-    );
+    Celestial *src = this->get_entity_or_default(src_id);
+
+    if (src == NULL) {
+        throw 33;
+    }
+
+    return this->get_all_distances(*src, param);
 }
 
 std::map<Celestial *, float> *Universe::get_all_distances(Celestial &src, Parameters *param) {
-    return Dijkstra(*this, &src, NULL, param).get_all_distances();
+    struct timespec start;
+
+    metrics.start(&start);
+    std::map<Celestial *, float> *res = Dijkstra(*this, &src, NULL, param).get_all_distances();
+    metrics.record_query(param, &start, true);
+
+    return res;
+}
+
+std::vector<float> Universe::get_reachable(int src_id, float max_seconds, Parameters *param) {
+    Celestial *src = this->get_entity_or_default(src_id);
+
+    if (src == NULL) {
+        throw 33;
+    }
+
+    return this->get_reachable(*src, max_seconds, param);
+}
+
+/*
+ * The shortest travel time to every system within the given number of
+ * seconds, indexed by sequence id. The search stops at the budget, so this
+ * is much cheaper than get_all_distances for short trips.
+ */
+std::vector<float> Universe::get_reachable(Celestial &src, float max_seconds, Parameters *param) {
+    struct timespec start;
+
+    std::vector<float> res;
+
+    metrics.start(&start);
+    Dijkstra(*this, &src, NULL, param).get_system_distances(max_seconds, &res, NULL);
+    metrics.record_query(param, &start, true);
+
+    return res;
+}
+
+SystemDistances *Universe::get_system_distances(int src_id, Parameters *param, float max_seconds) {
+    Celestial *src = this->get_entity_or_default(src_id);
+
+    if (src == NULL) {
+        throw 33;
+    }
+
+    return this->get_system_distances(*src, param, max_seconds);
+}
+
+/*
+ * Like get_all_distances, but reduced to the closest entity of every system,
+ * which is what nearly every caller wants, without a map of every entity.
+ */
+SystemDistances *Universe::get_system_distances(Celestial &src, Parameters *param, float max_seconds) {
+    struct timespec start;
+    SystemDistances *res = new SystemDistances();
+
+    metrics.start(&start);
+    Dijkstra(*this, &src, NULL, param).get_system_distances(max_seconds, &res->times, &res->entities);
+    metrics.record_query(param, &start, true);
+
+    return res;
+}
+
+std::string Universe::get_metrics_prometheus() {
+    return metrics.to_prometheus(*this);
+}
+
+std::string Universe::get_metrics_json() {
+    return metrics.to_json(*this);
+}
+
+int Universe::get_id_map_size() {
+    return entity_map.size() + system_map.size();
+}
+
+/*
+ * Hands out a workspace for a search, reusing a returned one if possible.
+ * Workspaces which no longer fit the universe are thrown away.
+ */
+Workspace *Universe::acquire_workspace() {
+    Workspace *w = NULL;
+
+    {
+        std::lock_guard<std::mutex> guard(workspace_lock);
+
+        while (!workspaces.empty() && w == NULL) {
+            w = workspaces.back();
+            workspaces.pop_back();
+
+            if (!w->fits(*this)) {
+                delete w;
+                w = NULL;
+                workspace_count--;
+            }
+        }
+
+        if (w == NULL) workspace_count++;
+    }
+
+    metrics.record_cache(CACHE_WORKSPACE, w != NULL);
+
+    return w ? w : new Workspace(*this);
+}
+
+void Universe::release_workspace(Workspace *w) {
+    std::lock_guard<std::mutex> guard(workspace_lock);
+    workspaces.push_back(w);
+}
+
+int Universe::get_workspace_count() {
+    std::lock_guard<std::mutex> guard(workspace_lock);
+    return workspace_count;
+}
+
+int Universe::get_workspaces_in_use() {
+    std::lock_guard<std::mutex> guard(workspace_lock);
+    return workspace_count - workspaces.size();
 }
 
 void Universe::add_dynamic_bridge(int src, float range) {
@@ -99,9 +504,33 @@ void Universe::add_dynamic_bridge(int src, float range) {
 }
 
 void Universe::add_dynamic_bridge(Celestial *src, float range) {
+    check_writable();
+
+    if (src == NULL) {
+        throw 33;
+    }
+
     src->jump_range = range;
+    record_change(true, CHANGE_DYNAMIC_BRIDGE, src->seq_id, -1);
+    update_gates(src->system);
+}
 
-    if (src->system->gates > src) src->system->gates = src;
+void Universe::remove_dynamic_bridge(int src) {
+    remove_dynamic_bridge(this->get_entity(src));
+}
+
+void Universe::remove_dynamic_bridge(Celestial *src) {
+    check_writable();
+
+    if (src == NULL) {
+        throw 33;
+    }
+
+    if (isnan(src->jump_range)) return;
+
+    src->jump_range = NAN;
+    record_change(false, CHANGE_DYNAMIC_BRIDGE, src->seq_id, -1);
+    update_gates(src->system);
 }
 
 void Universe::add_static_bridge(int src, int dst) {
@@ -109,24 +538,207 @@ void Universe::add_static_bridge(int src, int dst) {
 }
 
 void Universe::add_static_bridge(Celestial *src, Celestial *dst) {
+    check_writable();
+
+    if (src == NULL || dst == NULL) {
+        throw 33;
+    }
+
     if (src->bridge || dst->bridge) {
         throw 20;
     }
 
     src->bridge = dst;
-    if (src->system->gates > src) src->system->gates = src;
-
     dst->bridge = src;
-    if (dst->system->gates > dst) dst->system->gates = dst;
+    record_change(true, CHANGE_STATIC_BRIDGE, src->seq_id, dst->seq_id);
+
+    update_gates(src->system);
+    update_gates(dst->system);
+}
+
+/*
+ * Static bridges always come in pairs, so removing either end removes both.
+ */
+void Universe::remove_static_bridge(int src) {
+    remove_static_bridge(this->get_entity(src));
+}
+
+void Universe::remove_static_bridge(Celestial *src) {
+    check_writable();
+
+    if (src == NULL) {
+        throw 33;
+    }
+
+    Celestial *dst = src->bridge;
+
+    if (dst == NULL) return;
+
+    src->bridge = NULL;
+    if (dst->bridge == src) dst->bridge = NULL;
+    record_change(false, CHANGE_STATIC_BRIDGE, src->seq_id, dst->seq_id);
+
+    update_gates(src->system);
+    update_gates(dst->system);
+}
+
+/*
+ * Wormholes are two-way links between existing entities, which are taken like
+ * a stargate in both directions. They do not have entities of their own, so
+ * the signature of a wormhole should be anchored to the nearest celestial.
+ */
+void Universe::add_wormhole(int a, int b) {
+    add_wormhole(this->get_entity(a), this->get_entity(b));
+}
+
+void Universe::add_wormhole(Celestial *a, Celestial *b) {
+    check_writable();
+
+    if (a == NULL || b == NULL) {
+        throw 33;
+    }
+
+    if (a->destination || b->destination || a == b) {
+        throw 20;
+    }
+
+    a->destination = b;
+    b->destination = a;
+    record_change(true, CHANGE_WORMHOLE, a->seq_id, b->seq_id);
+
+    update_gates(a->system);
+    update_gates(b->system);
 }
 
+void Universe::remove_wormhole(int a) {
+    remove_wormhole(this->get_entity(a));
+}
+
+void Universe::remove_wormhole(Celestial *a) {
+    check_writable();
+
+    if (a == NULL) {
+        throw 33;
+    }
+
+    Celestial *b = a->destination;
+
+    if (b == NULL) return;
+
+    a->destination = NULL;
+    if (b->destination == a) b->destination = NULL;
+    record_change(false, CHANGE_WORMHOLE, a->seq_id, b->seq_id);
+
+    update_gates(a->system);
+    update_gates(b->system);
+}
+
+/*
+ * Removes a system from the graph. Its entry stays in the tables, so nothing
+ * else has to move, but it can no longer be looked up or routed through, and
+ * every connection of its entities is cut. Connections are taken to be
+ * symmetric, as they are in the SDE, so this only looks at the other ends of
+ * the connections of the system itself.
+ */
+void Universe::remove_system(int id) {
+    check_writable();
+
+    System *sys = this->get_system(id);
+    Celestial *ent;
+
+    if (sys == NULL) {
+        throw 31;
+    }
+
+    for (int i = 0; i < sys->entity_count; i++) {
+        ent = &sys->entities[i];
+
+        if (ent->type != STARGATE) {
+            remove_wormhole(ent);
+        } else if (ent->destination) {
+            if (ent->destination->destination == ent) remove_stargate(ent->destination);
+            remove_stargate(ent);
+        }
+
+        remove_static_bridge(ent);
+        remove_dynamic_bridge(ent);
+
+        this->entity_map.erase(ent->id);
+    }
+
+    sys->removed = true;
+    this->system_map.erase(id);
+    record_change(false, CHANGE_SYSTEM, sys->seq_id, -1);
+}
+
+/*
+ * Jumps land on the entities of a system from its gates onwards, which start
+ * at the first stargate or station, or the first entity with a connection of
+ * its own if that comes earlier. This only looks at a single system, so it is
+ * cheap enough to call after every change.
+ */
+void Universe::update_gates(System *sys) {
+    Celestial *ent;
+
+    sys->gates = NULL;
+
+    for (int i = 0; i < sys->entity_count; i++) {
+        ent = &sys->entities[i];
+
+        if ((ent->id >= 50000000 && ent->id < 70000000) || ent->is_relevant()) {
+            sys->gates = ent;
+            return;
+        }
+    }
+}
+
+void Universe::record_change(bool added, enum graph_change_type type, int src, int dst) {
+    generation++;
+
+    this->journal.push_back({ generation, added, type, src, dst });
+
+    if (this->journal.size() > JOURNAL_SIZE) {
+        this->journal.pop_front();
+    }
+}
+
+/*
+ * Appends the changes after the given generation. Returns false if they are
+ * not all known, as they have fallen out of the journal, or the universe
+ * changed in some other way, such as systems being added or sorted, in which
+ * case anything derived from that generation must be built again.
+ */
+bool Universe::get_changes(int since, std::vector<struct graph_change> *changes) {
+    auto i = std::upper_bound(this->journal.begin(), this->journal.end(), since, [](int g, const struct graph_change &c) {
+        return g < c.generation;
+    });
+
+    if (this->journal.end() - i != this->generation - since) {
+        return false;
+    }
+
+    changes->insert(changes->end(), i, this->journal.end());
+    return true;
+}
+
+
+/*
+ * Adds a system with room for the given number of entities. Throws if the
+ * universe does not have the capacity for either.
+ */
+void Universe::add_system(int id, char *name, double x, double y, double z, unsigned int entities, float security, int region) {
+    check_writable();
+
+    if (this->system_count >= this->system_capacity || entities > (unsigned int) (this->entity_capacity - (this->last_entity - this->entities))) {
+        throw 30;
+    }
 
-void Universe::add_system(int id, char *name, double x, double y, double z, unsigned int entities, float security) {
     int seq_id = this->system_count++;
     System *s = &(this->systems[seq_id]);
+    generation++;
     this->system_map[id] = seq_id;
 
-    s->name = std::string(name);
+    s->name = store_name(name);
     s->id = id;
     s->seq_id = seq_id;
     s->entity_count = 0;
@@ -136,17 +748,36 @@ void Universe::add_system(int id, char *name, double x, double y, double z, unsi
     s->z = z;
 
     s->security = security;
+    s->region_id = region;
+    s->removed = false;
 
     s->gates = NULL;
     s->entities = this->last_entity;
     this->last_entity += entities;
 }
 
+/*
+ * Adds an entity to a system, in the space the system reserved for it. Throws
+ * if the system does not exist or its space is used up.
+ */
 Celestial *Universe::add_entity(int system, int id, enum entity_type type, char *name, double x, double y, double z, Celestial *destination) {
+    check_writable();
+
     System *s = this->get_system(system);
+
+    if (s == NULL) {
+        throw 31;
+    }
+
+    if (&s->entities[s->entity_count] >= (s->seq_id + 1 < this->system_count ? this->systems[s->seq_id + 1].entities.get() : this->last_entity)) {
+        throw 32;
+    }
+
     Celestial *e = &s->entities[s->entity_count++];
+    this->max_system_entities = std::max(this->max_system_entities, s->entity_count);
     int seq_id = e - this->entities;
     this->entity_count++;
+    generation++;
     int important = 0;
 
     if (id >= 40000000 && id < 50000000) {
@@ -163,7 +794,7 @@ Celestial *Universe::add_entity(int system, int id, enum entity_type type, char
         s->gates = e;
     }
 
-    e->name = std::string(name);
+    e->name = store_name(name);
     e->id = id;
     e->seq_id = seq_id;
 
@@ -176,6 +807,7 @@ Celestial *Universe::add_entity(int system, int id, enum entity_type type, char
     e->bridge = NULL;
 
     e->type = type;
+    e->group_id = 0;
     e->destination = destination;
 
     return e;
@@ -200,15 +832,17 @@ void Universe::load_systems_and_entities(FILE *f) {
                 &id, &type_id, &group_id, solar_system_str, region_str, &x, &y, &z, name, security
             );
 
+            if (res == EOF) break;
+
             if (strcmp("None", solar_system_str) == 0) {
                 system_id = 0;
             } else {
                 system_id = atoi(solar_system_str);
             }
 
-            if (id >= 30000000 && id < 70000000) {
-                region_id = atoi(region_str);
+            region_id = atoi(region_str);
 
+            if (id >= 30000000 && id < 70000000) {
                 if (region_id == 10000019 || region_id == 10000017 || region_id == 10000004) {
                     continue;
                 }
@@ -224,7 +858,7 @@ void Universe::load_systems_and_entities(FILE *f) {
                 }
             } else {
                 if (id >= 30000000 && id < 40000000) {
-                    this->add_system(id, name, x, y, z, per_system_entities[id], atof(security));
+                    this->add_system(id, name, x, y, z, per_system_entities[id], atof(security), region_id);
                 } else if (id >= 40000000 && id < 50000000) {
                     ent = this->add_entity(system_id, id, CELESTIAL, name, x, y, z, NULL);
                     ent->group_id = group_id;
@@ -248,6 +882,8 @@ void Universe::load_stargates(FILE *f) {
     do {
         res = fscanf(f, "%d,%d\n", &src, &dst);
 
+        if (res == EOF) break;
+
         src_e = this->get_entity(src);
         dst_e = this->get_entity(dst);
 
@@ -255,20 +891,373 @@ void Universe::load_stargates(FILE *f) {
             continue;
         }
 
-        src_e->destination=dst_e;
-
-        src_e->name = std::string(src_e->system->name + " - " + dst_e->system->name + " gate");
+        this->connect_stargate(src_e, dst_e);
     } while (res != EOF);
 }
 
-void Universe::initialise(FILE *entities, FILE *gates) {
-    this->entities = new Celestial[500000];
-    this->systems = new System[9000];
+void Universe::add_stargate(int src, int dst) {
+    add_stargate(this->get_entity(src), this->get_entity(dst));
+}
+
+/*
+ * Connects a stargate to its destination. Stargates are one-way as far as the
+ * universe is concerned, so a regular pair of gates needs two calls.
+ */
+void Universe::add_stargate(Celestial *src, Celestial *dst) {
+    check_writable();
+
+    if (src == NULL || dst == NULL) {
+        throw 33;
+    }
+
+    if (src->destination) {
+        remove_stargate(src);
+    }
+
+    connect_stargate(src, dst);
+    record_change(true, CHANGE_STARGATE, src->seq_id, dst->seq_id);
+    update_gates(src->system);
+}
+
+/*
+ * Points a stargate at its destination and names it, without recording a
+ * change. Loading uses this directly, as nothing can have been derived from
+ * the universe before it is complete, and stargates from the SDE are
+ * already among the gates of their systems.
+ */
+void Universe::connect_stargate(Celestial *src, Celestial *dst) {
+    char name[512];
+
+    if (src->destination == NULL) this->stargate_count++;
+
+    src->destination = dst;
+
+    /*
+     * A gate which is taken down and put back up keeps its name, rather than
+     * storing another copy of it every time.
+     */
+    snprintf(name, sizeof(name), "%s - %s gate", src->system->name.get(), dst->system->name.get());
+
+    if (src->name.get() == NULL || strcmp(src->name.get(), name) != 0) {
+        src->name = store_name(name);
+    }
+}
+
+/*
+ * Disconnects a stargate. Like adding one, this only affects a single
+ * direction, and the name of the stargate is kept.
+ */
+void Universe::remove_stargate(int src) {
+    remove_stargate(this->get_entity(src));
+}
+
+void Universe::remove_stargate(Celestial *src) {
+    check_writable();
+
+    if (src == NULL) {
+        throw 33;
+    }
+
+    Celestial *dst = src->destination;
+
+    if (dst == NULL) return;
+
+    this->stargate_count--;
+
+    src->destination = NULL;
+    record_change(false, CHANGE_STARGATE, src->seq_id, dst->seq_id);
+    update_gates(src->system);
+}
+
+/*
+ * Renumbers the systems in order of their x coordinate, and lays out their
+ * entities in the same order. This lets the jump range scan binary search
+ * for the slab of systems close enough in x, and keeps systems which are
+ * close in space close in memory. Every system keeps the space it reserved,
+ * so entities can still be added to it afterwards, as long as they fit.
+ */
+void Universe::sort_systems() {
+    check_writable();
+
+    std::vector<int> order(system_count), system_seq(system_count), entity_seq(last_entity - entities, -1);
+    System *new_systems = new System[system_capacity];
+    Celestial *new_entities = new Celestial[entity_capacity];
+    Celestial *next = new_entities;
+
+    for (int i = 0; i < system_count; i++) {
+        order[i] = i;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+        return systems[a].x < systems[b].x;
+    });
+
+    for (int i = 0; i < system_count; i++) {
+        System &o = systems[order[i]], &n = new_systems[i];
+        Celestial *end = order[i] + 1 < system_count ? systems[order[i] + 1].entities.get() : last_entity;
+
+        system_seq[order[i]] = i;
+
+        n = o;
+        n.seq_id = i;
+        n.entities = next;
+        n.gates = o.gates ? next + (o.gates - o.entities) : NULL;
+
+        for (int j = 0; j < o.entity_count; j++) {
+            entity_seq[o.entities[j].seq_id] = next - new_entities + j;
+        }
+
+        next += end - o.entities;
+    }
+
+    for (int i = 0; i < system_count; i++) {
+        for (int j = 0; j < systems[i].entity_count; j++) {
+            Celestial &o = systems[i].entities[j], &n = new_entities[entity_seq[o.seq_id]];
+
+            n = o;
+            n.seq_id = entity_seq[o.seq_id];
+            n.system = new_systems + system_seq[i];
+            n.destination = o.destination ? new_entities + entity_seq[o.destination->seq_id] : NULL;
+            n.bridge = o.bridge ? new_entities + entity_seq[o.bridge->seq_id] : NULL;
+        }
+    }
+
+    for (auto &i : system_map) {
+        i.second = system_seq[i.second];
+    }
+
+    for (auto &i : entity_map) {
+        i.second = entity_seq[i.second];
+    }
+
+    delete[] systems;
+    delete[] entities;
+
+    systems = new_systems;
+    entities = new_entities;
+    last_entity = next;
+
+    sorted_systems = system_count;
+    generation++;
+    journal.clear();
+}
+
+/*
+ * Throws if the universe is attached to an exported one, which is mapped
+ * read-only.
+ */
+void Universe::check_writable() {
+    if (this->read_only) {
+        throw 43;
+    }
+}
+
+/*
+ * Copies a name into the universe. Names are packed into large blocks which
+ * never move, so entities can point straight at them.
+ */
+const char *Universe::store_name(const char *name) {
+    unsigned long length = strlen(name) + 1;
+    char *r;
+
+    if (this->name_next == NULL || length > (unsigned long) (this->name_end - this->name_next)) {
+        unsigned long size = std::max(length, (unsigned long) NAME_BLOCK_SIZE);
+
+        this->name_blocks.push_back(new char[size]);
+        this->name_next = this->name_blocks.back();
+        this->name_end = this->name_next + size;
+    }
+
+    r = this->name_next;
+    memcpy(r, name, length);
+
+    this->name_next += length;
+    this->names_size += length;
+
+    return r;
+}
+
+/*
+ * Writes the systems, entities and names of the universe to a file, from
+ * which any number of processes can attach_shared the same universe without
+ * loading it again. Files on a tmpfs such as /dev/shm are shared memory. The
+ * file is written under a temporary name and renamed into place, so that
+ * processes attaching meanwhile never see a partial file.
+ */
+void Universe::export_shared(std::string path) {
+    struct shared_header h = {};
+    std::string tmp = path + ".tmp";
+    int slots = this->last_entity - this->entities, fd;
+    unsigned long names = 0;
+    char *base, *n;
+
+    for (int i = 0; i < this->system_count; i++) {
+        names += strlen(this->systems[i].name) + 1;
+    }
+
+    for (int i = 0; i < slots; i++) {
+        if (this->entities[i].name) names += strlen(this->entities[i].name) + 1;
+    }
+
+    memcpy(h.magic, SHARED_MAGIC, sizeof(h.magic));
+    h.version = SHARED_VERSION;
+    h.system_size = sizeof(System);
+    h.entity_size = sizeof(Celestial);
+
+    h.system_count = this->system_count;
+    h.entity_count = this->entity_count;
+    h.entity_slots = slots;
+    h.stargate_count = this->stargate_count;
+    h.sorted_systems = this->sorted_systems;
+    h.max_system_entities = this->max_system_entities;
+
+    h.systems = SHARED_ALIGN(sizeof(h));
+    h.entities = SHARED_ALIGN(h.systems + this->system_count * sizeof(System));
+    h.names = SHARED_ALIGN(h.entities + slots * sizeof(Celestial));
+    h.size = h.names + names;
+
+    if ((fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        throw 41;
+    }
+
+    if (ftruncate(fd, h.size) != 0 || (base = (char *) mmap(NULL, h.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        unlink(tmp.c_str());
+        throw 41;
+    }
+
+    close(fd);
+
+    System *s = (System *) (base + h.systems);
+    Celestial *e = (Celestial *) (base + h.entities);
+    n = base + h.names;
+
+    /*
+     * Copies of offset pointers still point at the originals, so every
+     * pointer is set again to the same place within the file.
+     */
+    for (int i = 0; i < this->system_count; i++) {
+        System &o = this->systems[i], *c = new (&s[i]) System(o);
+
+        c->entities = e + (o.entities - this->entities);
+        c->gates = o.gates ? e + (o.gates - this->entities) : NULL;
+        c->name = n;
+        n = stpcpy(n, o.name) + 1;
+    }
+
+    for (int i = 0; i < slots; i++) {
+        Celestial &o = this->entities[i], *c = new (&e[i]) Celestial(o);
+
+        c->system = o.system ? s + o.system->seq_id : NULL;
+        c->destination = o.destination ? e + (o.destination - this->entities) : NULL;
+        c->bridge = o.bridge ? e + (o.bridge - this->entities) : NULL;
+
+        if (o.name) {
+            c->name = n;
+            n = stpcpy(n, o.name) + 1;
+        }
+    }
+
+    memcpy(base, &h, sizeof(h));
+    munmap(base, h.size);
+
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        throw 41;
+    }
+}
+
+/*
+ * Maps a universe written by export_shared read-only, so that it shares its
+ * tables with every other process which attached it. Only the id maps are
+ * built again. Anything which would change the universe throws.
+ */
+Universe *Universe::attach_shared(std::string path) {
+    struct shared_header h;
+    struct stat st;
+    void *base;
+    int fd;
+
+    if ((fd = open(path.c_str(), O_RDONLY)) < 0) {
+        throw 41;
+    }
+
+    if (fstat(fd, &st) != 0 || (unsigned long) st.st_size < sizeof(h) || (base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        throw 41;
+    }
+
+    close(fd);
+    memcpy(&h, base, sizeof(h));
+
+    if (memcmp(h.magic, SHARED_MAGIC, sizeof(h.magic)) != 0 || h.version != SHARED_VERSION ||
+        h.system_size != sizeof(System) || h.entity_size != sizeof(Celestial) || h.size != (unsigned long) st.st_size) {
+        munmap(base, st.st_size);
+        throw 42;
+    }
+
+    Universe *u = new Universe();
+
+    u->mapping = base;
+    u->mapping_size = h.size;
+    u->read_only = true;
+
+    u->systems = (System *) ((char *) base + h.systems);
+    u->entities = (Celestial *) ((char *) base + h.entities);
+    u->last_entity = u->entities + h.entity_slots;
+
+    u->system_count = u->system_capacity = h.system_count;
+    u->entity_count = h.entity_count;
+    u->entity_capacity = h.entity_slots;
+    u->stargate_count = h.stargate_count;
+    u->sorted_systems = h.sorted_systems;
+    u->max_system_entities = h.max_system_entities;
+    u->names_size = h.size - h.names;
+
+    /*
+     * Removed systems stay in the tables, but can not be found by id again,
+     * just as in the universe that was exported.
+     */
+    for (int i = 0; i < u->system_count; i++) {
+        System *s = &u->systems[i];
+
+        if (s->removed) continue;
+
+        u->system_map[s->id] = i;
+
+        for (int j = 0; j < s->entity_count; j++) {
+            Celestial *e = &s->entities[j];
+
+            if (e->id >= 40000000 && e->id < 70000000) {
+                u->entity_map[e->id] = e->seq_id;
+            }
+        }
+    }
+
+    return u;
+}
+
+void Universe::allocate(int systems, int entities) {
+    if (systems < 0 || entities < 0) {
+        throw 30;
+    }
+
+    this->system_capacity = systems;
+    this->entity_capacity = entities;
+
+    this->entities = new Celestial[this->entity_capacity];
+    this->systems = new System[this->system_capacity];
 
     this->last_entity = this->entities;
+}
+
+void Universe::initialise(FILE *entities, FILE *gates) {
+    this->allocate(9000, 500000);
 
     this->load_systems_and_entities(entities);
     this->load_stargates(gates);
+
+    this->sort_systems();
 }
 
 Universe::Universe(std::string entities, std::string gates) {
@@ -285,7 +1274,52 @@ Universe::Universe(FILE *entities, FILE *gates) {
     this->initialise(entities, gates);
 }
 
+/*
+ * Creates an empty universe with room for the given number of systems and
+ * entities, to be filled with add_system, add_entity and add_stargate.
+ */
+Universe::Universe(int systems, int entities) {
+    this->allocate(systems, entities);
+}
+
+Universe::Universe() {
+}
+
 Universe::~Universe() {
-    delete[] this->entities;
-    delete[] this->systems;
+    for (auto const& i : region_routers) {
+        delete i.second;
+    }
+
+    for (auto const& r : retired_region_routers) {
+        delete r;
+    }
+
+    for (auto const& i : jump_graphs) {
+        delete i.second;
+    }
+
+    for (auto const& g : retired_jump_graphs) {
+        delete g;
+    }
+
+    delete store;
+
+    for (auto const& s : retired_stores) {
+        delete s;
+    }
+
+    for (auto const& w : workspaces) {
+        delete w;
+    }
+
+    if (this->mapping) {
+        munmap(this->mapping, this->mapping_size);
+    } else {
+        delete[] this->entities;
+        delete[] this->systems;
+    }
+
+    for (auto const& b : name_blocks) {
+        delete[] b;
+    }
 }
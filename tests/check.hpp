@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdio.h>
+#include <math.h>
+
+#include "universe.hpp"
+
+/*
+ * The checks run by ctest. Each is a small program which counts the checks
+ * that fail, reports them on standard error, and fails if there are any.
+ */
+static int failures = 0;
+
+#define CHECK(condition, ...) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        failures++; \
+    } \
+} while (0)
+
+/*
+ * Costs found in different ways may differ by rounding, as the legs are
+ * summed in a different order.
+ */
+static inline bool same_cost(double a, double b) {
+    return fabs(a - b) <= 0.01 + 1E-5 * fabs(b);
+}
+
+/*
+ * A fixed sequence of systems, which is the same for every run.
+ */
+static inline System *pick_system(Universe *u, unsigned int *state) {
+    *state = *state * 1103515245 + 12345;
+    return &u->systems[(*state >> 8) % u->system_count];
+}
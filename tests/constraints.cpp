@@ -0,0 +1,83 @@
+#include <vector>
+
+#include "check.hpp"
+#include "synthetic.hpp"
+
+static bool enters(Route *route, int system, int region) {
+    for (unsigned int i = 1; i + 1 < route->points.size(); i++) {
+        System *s = route->points[i].entity->system;
+
+        if (s == route->points.front().entity->system || s == route->points.back().entity->system) continue;
+        if (s->id == system || s->region_id == region) return true;
+    }
+
+    return false;
+}
+
+/*
+ * Routes between fixed pairs of systems, and checks that avoided systems and
+ * regions and systems outside of the security limits are never entered on
+ * the way, and that a security penalty does not change the reported time.
+ */
+int main() {
+    Universe *u = SyntheticUniverse(400, 10, 2.6, 0.02, 50, 3).generate();
+    unsigned int state = 1;
+
+    for (int i = 0; i < 50; i++) {
+        System *a = pick_system(u, &state), *b = pick_system(u, &state);
+        Parameters p;
+        Route *base = u->get_route(a->entities[0].id, b->entities[0].id, &p);
+
+        if (base == NULL || base->points.size() < 4) {
+            delete base;
+            continue;
+        }
+
+        System *middle = base->points[base->points.size() / 2].entity->system;
+
+        if (middle != a && middle != b) {
+            Parameters q;
+            q.avoided_systems.push_back(middle->id);
+
+            Route *r = u->get_route(a->entities[0].id, b->entities[0].id, &q);
+            CHECK(r == NULL || !enters(r, middle->id, -1), "%d to %d enters avoided system %d", a->id, b->id, middle->id);
+            CHECK(r == NULL || r->cost >= base->cost - 0.01, "%d to %d is faster when avoiding a system", a->id, b->id);
+            delete r;
+        }
+
+        if (middle->region_id != a->region_id && middle->region_id != b->region_id) {
+            Parameters q;
+            q.avoided_regions.push_back(middle->region_id);
+
+            Route *r = u->get_route(a->entities[0].id, b->entities[0].id, &q);
+            CHECK(r == NULL || !enters(r, -1, middle->region_id), "%d to %d enters avoided region %d", a->id, b->id, middle->region_id);
+            delete r;
+        }
+
+        Parameters high;
+        high.min_security = 0.5;
+
+        Route *r = u->get_route(a->entities[0].id, b->entities[0].id, &high);
+
+        for (unsigned int j = 0; r && j < r->points.size(); j++) {
+            System *s = r->points[j].entity->system;
+            CHECK(s == a || s == b || s->security >= 0.5, "%d to %d enters %d at security %.1f", a->id, b->id, s->id, s->security);
+        }
+
+        delete r;
+
+        Parameters safe;
+        safe.security_penalty = 100;
+
+        r = u->get_route(a->entities[0].id, b->entities[0].id, &safe);
+        CHECK(r != NULL && r->cost >= base->cost - 0.01, "%d to %d is faster with a security penalty", a->id, b->id);
+        CHECK(r != NULL && same_cost(r->points.back().time, r->cost), "%d to %d reports the penalty in its time", a->id, b->id);
+        delete r;
+
+        delete base;
+    }
+
+    delete u;
+
+    return failures ? 1 : 0;
+}
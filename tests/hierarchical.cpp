@@ -0,0 +1,33 @@
+#include "check.hpp"
+#include "synthetic.hpp"
+
+/*
+ * The hierarchical router must find routes exactly as fast as the flat
+ * solver, within and across regions, for every ship it routes.
+ */
+int main() {
+    Universe *u = SyntheticUniverse(600, 10, 2.6, 0.02, 50, 5).generate();
+    unsigned int state = 2;
+
+    for (int i = 0; i < 200; i++) {
+        System *a = pick_system(u, &state), *b = pick_system(u, &state);
+        Parameters p = *presets[i % 7].parameters;
+
+        Route *flat = u->get_route(a->entities[0].id, b->entities[1].id, &p);
+        Route *hierarchical = u->get_hierarchical_route(a->entities[0].id, b->entities[1].id, &p);
+
+        CHECK((flat == NULL) == (hierarchical == NULL), "%d to %d is only found by one router", a->id, b->id);
+
+        if (flat && hierarchical) {
+            CHECK(same_cost(flat->cost, hierarchical->cost), "%d to %d costs %.3f flat and %.3f hierarchical", a->id, b->id, flat->cost, hierarchical->cost);
+            CHECK(hierarchical->points.back().entity == &b->entities[1], "%d to %d ends elsewhere", a->id, b->id);
+        }
+
+        delete flat;
+        delete hierarchical;
+    }
+
+    delete u;
+
+    return failures ? 1 : 0;
+}
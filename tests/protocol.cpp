@@ -0,0 +1,70 @@
+#include <string>
+#include <string.h>
+
+#include "check.hpp"
+#include "protocol.hpp"
+#include "synthetic.hpp"
+
+static bool starts_with(const std::string &s, const std::string &prefix) {
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+/*
+ * Parses well-formed and malformed request lines of the server and batch
+ * protocols, and answers a few of them on a small universe.
+ */
+int main() {
+    Universe *u = SyntheticUniverse(50, 10, 2.6, 0.02, 50, 11).generate();
+    Parameters defaults = BATTLESHIP;
+    enum request_result result;
+    struct request r;
+    std::string s;
+
+    CHECK(parse_request("30000001 30000002", defaults, false, &r), "%s", r.error.c_str());
+    CHECK(r.src == 30000001 && r.dst == 30000002 && r.parameters.warp_speed == BATTLESHIP.warp_speed, "plain request");
+
+    CHECK(parse_request("{\"id\": \"a\", \"src\": 1, \"dst\": 2, \"jump\": 6.5, \"preset\": \"carrier\", \"avoid\": [3, 4]}", defaults, false, &r), "%s", r.error.c_str());
+    CHECK(r.id == "\"a\"", "id is %s", r.id.c_str());
+    CHECK(r.parameters.warp_speed == CARRIER.warp_speed && r.parameters.jump_range == 6.5f, "preset and override");
+    CHECK(r.parameters.avoided_systems.size() == 2 && r.parameters.avoided_systems[1] == 4, "avoid list");
+
+    CHECK(parse_request("{\"src\": 1, \"dst\": 2, \"jump\": null}", CARRIER, false, &r) && isnan(r.parameters.jump_range), "null parameter");
+    CHECK(parse_request("{\"op\": \"metrics\"}", defaults, false, &r) && r.op == request::METRICS, "metrics op");
+
+    static const struct {
+        const char *line, *error;
+    } malformed[] = {
+        { "30000001", "malformed request" },
+        { "1 2 3", "malformed request" },
+        { "{\"src\": 1, \"dst\": 2", "malformed request" },
+        { "{\"src\": 1}", "src and dst are required" },
+        { "{\"src\": 1, \"dst\": 2, \"colour\": 3}", "unknown field" },
+        { "{\"src\": 1, \"dst\": 2, \"preset\": \"SHUTTLE\"}", "unknown preset" },
+        { "{\"src\": 1, \"dst\": 2, \"warp\": \"fast\"}", "ship parameters must be numbers or null" },
+        { "{\"src\": \"1\", \"dst\": 2}", "src and dst must be numbers" },
+    };
+
+    for (auto const& m : malformed) {
+        CHECK(!parse_request(m.line, defaults, false, &r) && r.error == m.error, "%s gives \"%s\"", m.line, r.error.c_str());
+    }
+
+    int src = u->systems[0].entities[0].id, dst = u->systems[1].entities[0].id;
+    Route *expected = u->get_route(src, dst, &defaults);
+    char line[128], prefix[128];
+
+    snprintf(line, sizeof(line), "{\"id\": 7, \"src\": %d, \"dst\": %d}", src, dst);
+    snprintf(prefix, sizeof(prefix), "{\"id\": 7, \"src\": %d, \"dst\": %d, \"cost\": %.3f, ", src, dst, expected->cost);
+    s = handle_request(*u, line, defaults, false, &result);
+    CHECK(result == REQUEST_FOUND && starts_with(s, prefix) && s.back() == '\n', "route response %s", s.c_str());
+
+    s = handle_request(*u, "{\"id\": 8, \"src\": 1, \"dst\": 2}", defaults, false, &result);
+    CHECK(result == REQUEST_FAILED && s == "{\"id\": 8, \"src\": 1, \"dst\": 2, \"error\": \"unknown src\"}\n", "unknown src response %s", s.c_str());
+
+    s = handle_request(*u, "{\"op\": \"metrics\"}", defaults, false, &result);
+    CHECK(result == REQUEST_FOUND && starts_with(s, "{\"metrics\": {"), "metrics response %s", s.c_str());
+
+    delete expected;
+    delete u;
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,69 @@
+#include <map>
+#include <vector>
+
+#include "check.hpp"
+#include "synthetic.hpp"
+#include "distance_tree.hpp"
+
+/*
+ * Changes the connections of a universe at random, and checks after every
+ * change that a distance tree repairs itself to the same distances as a
+ * search from scratch.
+ */
+int main() {
+    Universe *u = SyntheticUniverse(300, 10, 2.6, 0.02, 50, 7).generate();
+    Parameters p = BATTLESHIP;
+    std::vector<Celestial *> gates, removed;
+    unsigned int state = 3;
+
+    p.fatigue_model = FATIGUE_REACTIVATION_COST;
+
+    for (int i = 0; i < u->get_entity_slots(); i++) {
+        if (u->entities[i].destination) gates.push_back(&u->entities[i]);
+    }
+
+    DistanceTree tree(*u, u->systems[0].entities[0], &p);
+
+    for (int i = 0; i < 60; i++) {
+        System *a = pick_system(u, &state), *b = pick_system(u, &state);
+        Celestial *x = &a->entities[a->entity_count - 1], *y = &b->entities[b->entity_count - 1];
+
+        if (i % 4 == 0) {
+            Celestial *g = gates[(state >> 4) % gates.size()];
+
+            if (g->destination) {
+                removed.push_back(g->destination);
+                removed.push_back(g);
+                u->remove_stargate(g);
+            }
+        } else if (i % 4 == 1 && !removed.empty()) {
+            Celestial *g = removed.back();
+            removed.pop_back();
+            u->add_stargate(g, removed.back());
+            removed.pop_back();
+        } else if (i % 4 == 2 && !x->bridge && !y->bridge && x != y) {
+            u->add_static_bridge(x, y);
+        } else if (x->bridge) {
+            u->remove_static_bridge(x);
+        }
+
+        CHECK(tree.update(), "change %d was searched again rather than repaired", i);
+
+        std::map<Celestial *, float> *repaired = tree.get_all_distances();
+        std::map<Celestial *, float> *fresh = u->get_all_distances(u->systems[0].entities[0].id, &p);
+
+        CHECK(repaired->size() == fresh->size(), "change %d reaches %zu entities instead of %zu", i, repaired->size(), fresh->size());
+
+        for (auto const& d : *fresh) {
+            auto r = repaired->find(d.first);
+            CHECK(r != repaired->end() && same_cost(r->second, d.second), "change %d leaves %d at %.3f instead of %.3f", i, d.first->id, r == repaired->end() ? NAN : r->second, d.second);
+        }
+
+        delete repaired;
+        delete fresh;
+    }
+
+    delete u;
+
+    return failures ? 1 : 0;
+}
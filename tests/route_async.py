@@ -0,0 +1,24 @@
+import asyncio
+import sys
+
+import eve_nerd
+
+# A small synthetic universe, so that the test does not need the SDE.
+u = eve_nerd.SyntheticUniverse(systems=200, entities=10, seed=7).generate()
+systems = list(u.get_systems())
+src, dst = systems[0].id, systems[-1].id
+
+expected = u.get_route([src, dst], eve_nerd.BATTLECRUISER)
+
+route = u.route_async(src, dst, eve_nerd.BATTLECRUISER).result()
+
+if route is None or abs(route.cost - expected.cost) > 1E-3:
+    sys.exit("route_async does not match get_route")
+
+async def main():
+    return await u.route_asyncio(src, dst, eve_nerd.BATTLECRUISER)
+
+route = asyncio.run(main())
+
+if route is None or abs(route.cost - expected.cost) > 1E-3:
+    sys.exit("route_asyncio does not match get_route")
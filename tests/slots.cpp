@@ -0,0 +1,49 @@
+#include "check.hpp"
+#include "distance_tree.hpp"
+
+/*
+ * Systems may reserve more entity slots than they fill, before and after
+ * the universe is sorted. Every kind of search must cope with the gaps.
+ */
+int main() {
+    Universe u(10, 100);
+    char a[] = "A", b[] = "B", gate[] = "gate", planet[] = "planet";
+    Parameters p;
+
+    u.add_system(30000001, a, 5E16, 0, 0, 40, 0.9, 10000001);
+    u.add_system(30000002, b, 1E16, 0, 0, 5, 0.9, 10000001);
+
+    Celestial *x = u.add_entity(30000001, 50000001, STARGATE, gate, 0, 1E11, 0, NULL);
+    Celestial *y = u.add_entity(30000002, 50000002, STARGATE, gate, 0, 1E11, 0, NULL);
+    u.add_entity(30000001, 40000001, CELESTIAL, planet, 1E11, 0, 0, NULL);
+
+    u.add_stargate(x, y);
+    u.add_stargate(y, x);
+
+    for (int sorted = 0; sorted < 2; sorted++) {
+        Route *flat = u.get_route(40000001, 50000002, &p);
+        Route *hierarchical = u.get_hierarchical_route(40000001, 50000002, &p);
+        std::map<Celestial *, float> *all = u.get_all_distances(40000001, &p);
+        DistanceTree tree(u, 40000001, &p);
+
+        CHECK(flat && flat->points.size() == 3, "no route with %s slots", sorted ? "sorted" : "spare");
+        CHECK(flat && hierarchical && same_cost(flat->cost, hierarchical->cost), "hierarchical route differs");
+        CHECK(flat && same_cost(tree.get_distance(50000002), flat->cost), "distance tree differs");
+        CHECK(all->size() == 3, "%zu entities reached", all->size());
+
+        delete flat;
+        delete hierarchical;
+        delete all;
+
+        u.sort_systems();
+    }
+
+    CHECK(u.get_entity_slots() == 45, "sorting dropped reserved slots");
+    CHECK(u.add_entity(30000002, 40000002, CELESTIAL, planet, 1E11, 0, 0, NULL) != NULL, "no room after sorting");
+
+    Route *r = u.get_route(40000001, 40000002, &p);
+    CHECK(r && r->points.size() == 4, "no route to an entity added after sorting");
+    delete r;
+
+    return failures ? 1 : 0;
+}
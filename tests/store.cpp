@@ -0,0 +1,113 @@
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "check.hpp"
+#include "synthetic.hpp"
+
+static std::vector<std::string> list(const char *directory) {
+    std::vector<std::string> files;
+    struct dirent *e;
+    DIR *d = opendir(directory);
+
+    while (d && (e = readdir(d)) != NULL) {
+        if (e->d_name[0] != '.') files.push_back(std::string(directory) + "/" + e->d_name);
+    }
+
+    if (d) closedir(d);
+
+    return files;
+}
+
+static void remove_all(const char *directory) {
+    for (auto const& f : list(directory)) {
+        unlink(f.c_str());
+    }
+
+    rmdir(directory);
+}
+
+/*
+ * Routes a fixed set of queries, with a jump drive and hierarchically, so
+ * that both jump graphs and region tables go through the store. The jump
+ * drive goes first, before anything else can be mapped where an old store
+ * was.
+ */
+static std::vector<double> route(Universe *u) {
+    std::vector<double> costs;
+    Parameters capital = CARRIER, gates = BATTLESHIP;
+    unsigned int state = 4;
+
+    for (int i = 0; i < 20; i++) {
+        System *a = pick_system(u, &state), *b = pick_system(u, &state);
+        Route *r = i % 2 ? u->get_hierarchical_route(a->entities[0].id, b->entities[0].id, &gates) : u->get_route(a->entities[0].id, b->entities[0].id, &capital);
+
+        costs.push_back(r ? r->cost : NAN);
+        delete r;
+    }
+
+    return costs;
+}
+
+static bool same_costs(const std::vector<double> &a, const std::vector<double> &b) {
+    for (unsigned int i = 0; i < a.size(); i++) {
+        if (!(isnan(a[i]) && isnan(b[i])) && !same_cost(a[i], b[i])) return false;
+    }
+
+    return a.size() == b.size();
+}
+
+/*
+ * Fills a store, reads it back from another universe of the same map, and
+ * checks that the routes do not change, whether the store is replaced while
+ * its data is in use or its files are damaged.
+ */
+int main() {
+    SyntheticUniverse generator(500, 10, 2.6, 0.02, 50, 13);
+    char first[] = "/tmp/eve_nerd_store_XXXXXX", second[] = "/tmp/eve_nerd_store_XXXXXX";
+
+    CHECK(mkdtemp(first) && mkdtemp(second), "could not create the store directories");
+
+    Universe *u = generator.generate();
+    std::vector<double> plain = route(u);
+    delete u;
+
+    u = generator.generate();
+    u->open_store(first);
+    std::vector<double> filled = route(u);
+    delete u;
+
+    CHECK(!list(first).empty(), "nothing was stored");
+    CHECK(same_costs(plain, filled), "routes change when filling the store");
+
+    unsigned int stored = list(first).size();
+
+    u = generator.generate();
+    u->open_store(first);
+    CHECK(same_costs(plain, route(u)), "routes change when reading the store");
+    CHECK(list(first).size() == stored, "the store is not reused by the same map");
+
+    u->open_store(second);
+    CHECK(same_costs(plain, route(u)), "routes change when the store is replaced");
+    delete u;
+
+    for (auto const& f : list(first)) {
+        FILE *file = fopen(f.c_str(), "r+");
+
+        fseek(file, -1, SEEK_END);
+        fputc(fgetc(file) ^ 1, file);
+        fclose(file);
+    }
+
+    u = generator.generate();
+    u->open_store(first);
+    CHECK(same_costs(plain, route(u)), "routes change when the store is damaged");
+    delete u;
+
+    remove_all(first);
+    remove_all(second);
+
+    return failures ? 1 : 0;
+}